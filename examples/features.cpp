@@ -37,7 +37,6 @@ void shader
 
 int main()
 {
-	// TODO: check for conflicting bindings
 	// TODO: check vertex shader compability with vulkan vertex attributes (pass as an extra)
 	// TODO: a way to check compability of vertex -> fragment stage (pass vertex shader as an extra)
 
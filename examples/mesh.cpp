@@ -51,7 +51,8 @@ void vertex_shader
 	layout_output <vec3, 2> &out_light_direction
 )
 {
-	vec4 p = mvp.proj * mvp.view * mvp.model * vec4(position, 1.0f);
+	// Recorded as a single expression, lowered on assignment
+	vec4 p = expr::lazy(mvp.proj) * mvp.view * mvp.model * expr::construct <vec4> (position, 1.0f);
 	// TODO: unary operator
 	p.y = -1.0f * p.y;
 
@@ -168,15 +169,24 @@ int main(int argc, char *argv[])
 
 	auto vertex_layout = littlevk::VertexLayout <littlevk::rgb32f, littlevk::rgb32f> ();
 
+	// Both stages together, so that the varyings can be optimized; matrix
+	// products on push constants alone are computed once per draw on the CPU,
+	// rather than for every vertex
+	auto [vertex, fragment, uniforms] = translate_linked(vertex_shader, fragment_shader, { .hoist_uniforms = true, .report = true });
+	assert(uniforms.size <= sizeof(MVP));
+
+	fmt::println("vertex shader: {}", *vertex.report);
+	fmt::println("fragment shader: {}", *fragment.report);
+
 	auto bundle = littlevk::ShaderStageBundle(app.device, deallocator)
-		.attach(translate <Stage::Vertex> (vertex_shader), vk::ShaderStageFlagBits::eVertex)
-		.attach(translate <Stage::Fragment> (fragment_shader), vk::ShaderStageFlagBits::eFragment);
+		.attach(vertex.source, vk::ShaderStageFlagBits::eVertex)
+		.attach(fragment.source, vk::ShaderStageFlagBits::eFragment);
 
 	littlevk::Pipeline ppl = littlevk::PipelineAssembler(app.device, app.window, deallocator)
 		.with_render_pass(render_pass, 0)
 		.with_vertex_layout(vertex_layout)
 		.with_shader_bundle(bundle)
-		.with_push_constant <MVP> (vk::ShaderStageFlagBits::eVertex);
+		.with_push_constant <MVP> (vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment);
 
 	// Syncronization primitives
 	auto sync = littlevk::present_syncronization(app.device, 2).unwrap(deallocator);
@@ -313,7 +323,10 @@ int main(int argc, char *argv[])
 		push_constants.light_direction = glm::normalize(glm::vec3 { 0, 0, 1 });
 
 		cmd.bindPipeline(vk::PipelineBindPoint::eGraphics, ppl.handle);
-		cmd.pushConstants <MVP> (ppl.layout, vk::ShaderStageFlagBits::eVertex, 0, push_constants);
+		std::array <std::byte, sizeof(MVP)> hoisted;
+		uniforms(&push_constants, hoisted.data());
+
+		cmd.pushConstants(ppl.layout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, uniforms.size, hoisted.data());
 		cmd.bindVertexBuffers(0, vertex_buffer.buffer, { 0 });
 		cmd.bindIndexBuffer(index_buffer.buffer, 0, vk::IndexType::eUint32);
 		cmd.drawIndexed(mesh.indices.size(), 1, 0, 0, 0);
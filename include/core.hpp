@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 #include "gir.hpp"
 
 // Primitive types
@@ -9,14 +11,13 @@
 // NOTE: Constructors for primitive types are simply initializers; the types
 // themself do not contain additional data, only interfaces to it.
 
-struct scalar_type {};
-
 struct f32 : gir_tree {
+	static constexpr gloa native_type = eFloat32;
+
 	explicit f32(const gir_tree &gt) : gir_tree(gt) {}
 
 	f32(float x = 0.0f) : gir_tree {
-		gir_tree::cfrom(eConstruct, {
-			gir_tree::cfrom(eFloat32),
+		gir_tree::cfrom(eConstruct, { eFloat32 }, {
 			gir_tree::cfrom(x)
 		})
 	} {}
@@ -27,144 +28,297 @@ enum glcomponents : int {
 	cX, cY, cZ, cW,
 };
 
-// TODO: use OR for composite components
 template <typename T, int N>
 struct vector_type {
 	using type = T;
 	static constexpr int components = N;
 };
 
-// TODO: requires vector_type info (alias)
+struct vec2;
+struct vec3;
+struct vec4;
+
+// Result type of reading N components
+template <int N>
+struct vector_of;
+
+template <>
+struct vector_of <1> {
+	using type = f32;
+};
+
+template <>
+struct vector_of <2> {
+	using type = vec2;
+};
+
+template <>
+struct vector_of <3> {
+	using type = vec3;
+};
+
+template <>
+struct vector_of <4> {
+	using type = vec4;
+};
+
+// Reads a swizzle of a vector, looking through the insertions recorded on it
+inline gir_tree read_swizzle(gir_tree ref_tree, int mask, gloa type)
+{
+	while (ref_tree.data() == eInsert) {
+		int written = ref_tree.header().index;
+
+		// Reading back exactly what was written
+		if (written == mask)
+			return ref_tree.children()[1];
+
+		int covered = swizzle_coverage(written);
+
+		// Untouched by this insertion
+		if (!(covered & swizzle_coverage(mask))) {
+			ref_tree = ref_tree.children()[0];
+			continue;
+		}
+
+		// A single component out of a wider write is read from the value
+		if (swizzle_size(mask) == 1) {
+			int c = swizzle_component(mask, 0);
+
+			int i = 0;
+			while (swizzle_component(written, i) != c)
+				i++;
+
+			mask = i;
+			ref_tree = ref_tree.children()[1];
+			continue;
+		}
+
+		// Partial overlap; read the vector as it is
+		break;
+	}
+
+	gir_tree cmp_tree = gir_tree::from(eComponent, { type, mask }, ref_tree.cexpr(), {
+		ref_tree
+	});
+
+	return ceval(cmp_tree);
+}
+
+// Records a single insertion of a swizzle into a vector
+inline gir_tree write_swizzle(gir_tree ref_tree, int mask, gloa type, const gir_tree &v)
+{
+	// Writes covering all of the previous insertion discard it
+	while (ref_tree.data() == eInsert) {
+		int covered = swizzle_coverage(ref_tree.header().index);
+		if (covered & ~swizzle_coverage(mask))
+			break;
+
+		ref_tree = ref_tree.children()[0];
+	}
+
+	bool cexpr = ref_tree.cexpr() & v.cexpr();
+
+	gir_tree inserted = gir_tree::from(eInsert, { type, mask }, cexpr, {
+		ref_tree, v
+	});
+
+	return ceval(inserted);
+}
+
+// NOTE: component references are empty and share the address of the vector
+// owning them, so that vectors remain a single trivially relocatable handle
 template <typename T, glcomponents glc>
 struct component_ref {
 	// Preload construction information
 	using vtype = typename T::alias::type;
 
-	std::reference_wrapper <T> ref;
+	T &owner() {
+		return *reinterpret_cast <T *> (this);
+	}
 
-	component_ref(const std::reference_wrapper <T> &ref_) : ref(ref_) {}
+	const T &owner() const {
+		return *reinterpret_cast <const T *> (this);
+	}
 
-	// Assigning to the value
+	// Assigning to the value; records a single insertion regardless of how
+	// many times the vector has been written to already
 	component_ref &operator=(const vtype &v) {
-		gir_tree ref_tree = ref.get();
-
-		std::vector <gir_tree> cmps;
-		cmps.resize(T::alias::components);
-		for (int i = 0; i < T::alias::components; i++) {
-			if (i == glc) {
-				cmps[i] = ceval(v);
-			} else {
-				// Gather the atomic components
-				gir_tree ct = gir_tree::from(eComponent, ref_tree.cexpr, {
-					gir_tree::cfrom(i),
-					ref_tree
-				});
-
-				cmps[i] = ceval(ct);
-			}
-		}
+		owner().gir_tree::operator=(write_swizzle(owner(), glc, T::native_type, v));
+		return *this;
+	}
 
-		cmps.insert(cmps.begin(), gir_tree::cfrom(T::alias::components));
-		cmps.insert(cmps.begin(), gir_tree::cfrom(T::native_type));
+	// Same component of another vector, e.g. a.x = b.x
+	component_ref &operator=(const component_ref &other) {
+		return *this = vtype(other);
+	}
 
-		bool cexpr = ref_tree.cexpr & v.cexpr;
+	// Fetching the result
+	operator vtype() const {
+		return vtype(read_swizzle(owner(), glc, vtype::native_type));
+	}
+};
+
+// Several components at once (e.g. v.xyz), read and written as one node
+template <typename T, glcomponents ... Cs>
+struct swizzle_ref {
+	static constexpr int mask = swizzle_mask({ Cs... });
+
+	using vtype = typename vector_of <sizeof...(Cs)>::type;
+
+	T &owner() {
+		return *reinterpret_cast <T *> (this);
+	}
 
-		T &tref = ref.get();
-		tref.rehash(eConstruct, cexpr, cmps);
+	const T &owner() const {
+		return *reinterpret_cast <const T *> (this);
+	}
 
+	swizzle_ref &operator=(const vtype &v) {
+		static_assert(swizzle_writable(mask), "swizzle names a component twice");
+		owner().gir_tree::operator=(write_swizzle(owner(), mask, T::native_type, v));
 		return *this;
 	}
 
-	// Fetching the result
-	operator vtype() const {
-		gir_tree ref_tree = ref.get();
-		gir_tree cmp_tree = gir_tree::from(eComponent, ref_tree.cexpr, {
-			gir_tree::cfrom(glc),
-			ref_tree
-		});
+	swizzle_ref &operator=(const swizzle_ref &other) {
+		return *this = vtype(other);
+	}
 
-		return vtype(ceval(cmp_tree));
+	operator vtype() const {
+		return vtype(read_swizzle(owner(), mask, vtype::native_type));
 	}
 };
 
+// Vectors must stay a bare handle for component references to find them, and
+// can then be copied, moved and destroyed trivially
+template <typename T>
+constexpr bool is_handle_layout = std::is_trivially_copy_constructible_v <T>
+	&& std::is_trivially_move_constructible_v <T>
+	&& std::is_trivially_destructible_v <T>
+	&& sizeof(T) == sizeof(gir_tree);
+
 struct vec2 : gir_tree {
 	static constexpr gloa native_type = eVec2;
 
 	using alias = vector_type <f32, 2>;
 
-	component_ref <vec2, cX> x = std::ref(*this);
-	component_ref <vec2, cY> y = std::ref(*this);
+	[[no_unique_address]] component_ref <vec2, cX> x;
+	[[no_unique_address]] component_ref <vec2, cY> y;
+
+	[[no_unique_address]] swizzle_ref <vec2, cY, cX> yx;
 
 	vec2(const gir_tree &gt) : gir_tree(gt) {}
 
+	// Any other swizzle, e.g. v.swizzle <cX, cX> ()
+	template <glcomponents ... Cs>
+	swizzle_ref <vec2, Cs...> &swizzle() {
+		return *reinterpret_cast <swizzle_ref <vec2, Cs...> *> (this);
+	}
+
+	// Only the handle is copied or assigned, not the component references
+	vec2(const vec2 &) = default;
+
+	vec2 &operator=(const vec2 &v) {
+		gir_tree::operator=(v);
+		return *this;
+	}
+
 	vec2(float x = 0.0f, float y = 0.0f) : gir_tree {
-		gir_tree::cfrom(eConstruct, {
-			gir_tree::cfrom(eVec2),
-			gir_tree::cfrom(2),
+		gir_tree::cfrom(eConstruct, { eVec2 }, {
 			gir_tree::cfrom(x),
 			gir_tree::cfrom(y)
 		})
 	} {}
+
+	// Constructors involving f32
+	vec2(f32 x, f32 y) : gir_tree {
+		gir_tree::from(eConstruct, { eVec2 }, x.cexpr() & y.cexpr(), {
+			x, y
+		})
+	} {}
 };
 
+static_assert(is_handle_layout <vec2>);
+
 struct vec3 : gir_tree {
 	static constexpr gloa native_type = eVec3;
 
 	using alias = vector_type <f32, 3>;
 
-	component_ref <vec3, cX> x = std::ref(*this);
-	component_ref <vec3, cY> y = std::ref(*this);
-	component_ref <vec3, cZ> z = std::ref(*this);
+	[[no_unique_address]] component_ref <vec3, cX> x;
+	[[no_unique_address]] component_ref <vec3, cY> y;
+	[[no_unique_address]] component_ref <vec3, cZ> z;
+
+	[[no_unique_address]] swizzle_ref <vec3, cX, cY> xy;
+	[[no_unique_address]] swizzle_ref <vec3, cY, cZ> yz;
+	[[no_unique_address]] swizzle_ref <vec3, cZ, cY, cX> zyx;
 
 	vec3(const gir_tree &gt) : gir_tree(gt) {}
 
-	// Copies need some care
-	vec3(const vec3 &v) : gir_tree(v) {}
+	// Any other swizzle, e.g. v.swizzle <cX, cZ> ()
+	template <glcomponents ... Cs>
+	swizzle_ref <vec3, Cs...> &swizzle() {
+		return *reinterpret_cast <swizzle_ref <vec3, Cs...> *> (this);
+	}
+
+	// Only the handle is copied or assigned, not the component references
+	vec3(const vec3 &) = default;
 
-	vec3 operator=(const vec3 &v) {
-		if (this != &v)
-			gir_tree::operator=(v);
+	vec3 &operator=(const vec3 &v) {
+		gir_tree::operator=(v);
 		return *this;
 	}
 
 	vec3(float x = 0.0f, float y = 0.0f, float z = 0.0f) : gir_tree {
-		gir_tree::cfrom(eConstruct, {
-			gir_tree::cfrom(eVec3),
-			gir_tree::cfrom(3),
+		gir_tree::cfrom(eConstruct, { eVec3 }, {
 			gir_tree::cfrom(x),
 			gir_tree::cfrom(y),
 			gir_tree::cfrom(z),
 		})
 	} {}
+
+	// Constructors involving f32
+	vec3(f32 x, f32 y, f32 z) : gir_tree {
+		gir_tree::from(eConstruct, { eVec3 }, x.cexpr() & y.cexpr() & z.cexpr(), {
+			x, y, z
+		})
+	} {}
 };
 
+static_assert(is_handle_layout <vec3>);
+
 struct vec4 : gir_tree {
 	static constexpr gloa native_type = eVec4;
 
 	using alias = vector_type <f32, 4>;
 
-	component_ref <vec4, cX> x = std::ref(*this);
-	component_ref <vec4, cY> y = std::ref(*this);
-	component_ref <vec4, cZ> z = std::ref(*this);
-	component_ref <vec4, cW> w = std::ref(*this);
+	[[no_unique_address]] component_ref <vec4, cX> x;
+	[[no_unique_address]] component_ref <vec4, cY> y;
+	[[no_unique_address]] component_ref <vec4, cZ> z;
+	[[no_unique_address]] component_ref <vec4, cW> w;
+
+	[[no_unique_address]] swizzle_ref <vec4, cX, cY> xy;
+	[[no_unique_address]] swizzle_ref <vec4, cZ, cW> zw;
+	[[no_unique_address]] swizzle_ref <vec4, cX, cY, cZ> xyz;
+	[[no_unique_address]] swizzle_ref <vec4, cW, cZ, cY, cX> wzyx;
 
 	explicit vec4(const gir_tree &gt) : gir_tree(gt) {}
 
-	// Copies need some care
-	vec4(const vec4 &v) : gir_tree(v) {}
+	// Any other swizzle, e.g. v.swizzle <cX, cZ, cW> ()
+	template <glcomponents ... Cs>
+	swizzle_ref <vec4, Cs...> &swizzle() {
+		return *reinterpret_cast <swizzle_ref <vec4, Cs...> *> (this);
+	}
+
+	// Only the handle is copied or assigned, not the component references
+	vec4(const vec4 &) = default;
 
-	vec4 operator=(const vec4 &v) {
-		if (this != &v)
-			gir_tree::operator=(v);
+	vec4 &operator=(const vec4 &v) {
+		gir_tree::operator=(v);
 		return *this;
 	}
 
-	// TODO: disable moves
-
 	vec4(float x = 0.0f, float y = 0.0f, float z = 0.0f, float w = 0.0f) : gir_tree {
-		gir_tree::cfrom(eConstruct, {
-			gir_tree::cfrom(eVec4),
-			gir_tree::cfrom(4),
+		gir_tree::cfrom(eConstruct, { eVec4 }, {
 			gir_tree::cfrom(x),
 			gir_tree::cfrom(y),
 			gir_tree::cfrom(z),
@@ -173,9 +327,7 @@ struct vec4 : gir_tree {
 	} {}
 
 	vec4(const vec2 &v, float z = 0.0f, float w = 0.0f) : gir_tree {
-		gir_tree::from(eConstruct, v.cexpr, {
-			gir_tree::cfrom(eVec4),
-			gir_tree::cfrom(3),
+		gir_tree::from(eConstruct, { eVec4 }, v.cexpr(), {
 			v,
 			gir_tree::cfrom(z),
 			gir_tree::cfrom(w)
@@ -183,9 +335,7 @@ struct vec4 : gir_tree {
 	} {}
 
 	vec4(const vec3 &v, float w = 0.0f) : gir_tree {
-		gir_tree::from(eConstruct, v.cexpr, {
-			gir_tree::cfrom(eVec4),
-			gir_tree::cfrom(2),
+		gir_tree::from(eConstruct, { eVec4 }, v.cexpr(), {
 			v,
 			gir_tree::cfrom(w)
 		})
@@ -193,14 +343,44 @@ struct vec4 : gir_tree {
 
 	// Constructors involving f32
 	vec4(const vec3 &v, f32 w) : gir_tree {
-		gir_tree::cfrom(eConstruct, {
-			gir_tree::cfrom(eVec4),
-			gir_tree::cfrom(2),
+		gir_tree::from(eConstruct, { eVec4 }, v.cexpr() & w.cexpr(), {
 			v, w
 		})
 	} {}
+
+	vec4(f32 x, f32 y, f32 z, f32 w) : gir_tree {
+		gir_tree::from(eConstruct, { eVec4 }, x.cexpr() & y.cexpr() & z.cexpr() & w.cexpr(), {
+			x, y, z, w
+		})
+	} {}
 };
 
+static_assert(is_handle_layout <vec4>);
+
+// Component references find their owner at their own address, so each must
+// sit at offset zero, which [[no_unique_address]] does not guarantee (MSVC
+// ignores it); offsetof is only conditionally supported for these types
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+#endif
+
+static_assert(offsetof(vec2, x) == 0 && offsetof(vec2, y) == 0 && offsetof(vec2, yx) == 0,
+	"(cppsl) vec2 component references must alias the handle");
+
+static_assert(offsetof(vec3, x) == 0 && offsetof(vec3, y) == 0 && offsetof(vec3, z) == 0
+	&& offsetof(vec3, xy) == 0 && offsetof(vec3, yz) == 0 && offsetof(vec3, zyx) == 0,
+	"(cppsl) vec3 component references must alias the handle");
+
+static_assert(offsetof(vec4, x) == 0 && offsetof(vec4, y) == 0 && offsetof(vec4, z) == 0
+	&& offsetof(vec4, w) == 0 && offsetof(vec4, xy) == 0 && offsetof(vec4, zw) == 0
+	&& offsetof(vec4, xyz) == 0 && offsetof(vec4, wzyx) == 0,
+	"(cppsl) vec4 component references must alias the handle");
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
 struct mat4;
 
 struct mat3 : gir_tree {
@@ -210,9 +390,7 @@ struct mat3 : gir_tree {
 	explicit mat3(const gir_tree &gt) : gir_tree(gt) {}
 
 	mat3(float x = 0.0f) : gir_tree {
-		gir_tree::cfrom(eConstruct, {
-				gir_tree::cfrom(eMat3),
-				gir_tree::cfrom(1),
+		gir_tree::cfrom(eConstruct, { eMat3 }, {
 				gir_tree::cfrom(x),
 		})
 	} {}
@@ -228,29 +406,21 @@ struct mat4 : gir_tree {
 	explicit mat4(const gir_tree &gt) : gir_tree(gt) {}
 
 	mat4(float x = 0.0f) : gir_tree {
-		gir_tree::cfrom(eConstruct, {
-				gir_tree::cfrom(eMat4),
-				gir_tree::cfrom(1),
+		gir_tree::cfrom(eConstruct, { eMat4 }, {
 				gir_tree::cfrom(x),
 		})
 	} {}
 };
 
 inline mat3::mat3(const mat4 &m) : gir_tree {
-	gir_tree::cfrom(eConstruct, {
-			gir_tree::cfrom(eMat3),
-			gir_tree::cfrom(1), m
-	})
+	gir_tree::from(eConstruct, { eMat3 }, m.cexpr(), { m })
 } {}
 
 // TODO: requires
 template <typename T, int Binding>
 struct layout_input {
 	operator T() const {
-		return gir_tree::vfrom(eLayoutInput, {
-			gir_tree::cfrom(T::native_type),
-			gir_tree::cfrom(Binding),
-		});
+		return gir_tree::vfrom(eLayoutInput, { T::native_type, Binding });
 	}
 };
 
@@ -259,37 +429,22 @@ struct layout_input <vec3, Binding> {
 	// TODO: function to generate this,
 	// OR vec3 <Injected> specialization with required injection
 	// and vec3 = vec3 <Regular>
-	const f32 x = f32(gir_tree::vfrom(eComponent, {
-		gir_tree::cfrom(0),
-		gir_tree::vfrom(eLayoutInput, {
-			gir_tree::cfrom(eVec3),
-			gir_tree::cfrom(Binding),
-		})
+	const f32 x = f32(gir_tree::vfrom(eComponent, { eFloat32, 0 }, {
+		gir_tree::vfrom(eLayoutInput, { eVec3, Binding })
 	}));
 
-	const f32 y = f32(gir_tree::vfrom(eComponent, {
-		gir_tree::cfrom(1),
-		gir_tree::vfrom(eLayoutInput, {
-			gir_tree::cfrom(eVec3),
-			gir_tree::cfrom(Binding),
-		})
+	const f32 y = f32(gir_tree::vfrom(eComponent, { eFloat32, 1 }, {
+		gir_tree::vfrom(eLayoutInput, { eVec3, Binding })
 	}));
 
-	const f32 z = f32(gir_tree::vfrom(eComponent, {
-		gir_tree::cfrom(2),
-		gir_tree::vfrom(eLayoutInput, {
-			gir_tree::cfrom(eVec3),
-			gir_tree::cfrom(Binding),
-		})
+	const f32 z = f32(gir_tree::vfrom(eComponent, { eFloat32, 2 }, {
+		gir_tree::vfrom(eLayoutInput, { eVec3, Binding })
 	}));
 
 	layout_input() {}
 
 	operator vec3() const {
-		return gir_tree::vfrom(eLayoutInput, {
-			gir_tree::cfrom(eVec3),
-			gir_tree::cfrom(Binding),
-		});
+		return gir_tree::vfrom(eLayoutInput, { eVec3, Binding });
 	}
 };
 
@@ -308,15 +463,13 @@ struct layout_output : T {
 template <typename T, typename ... Args>
 void push_constants_members_proxy(size_t N, size_t offset, T &sub, Args &... args)
 {
-	// TODO: add size information to pad structures appropriately...
-	sub = T(gir_tree::vfrom(ePushConstants, {
-		gir_tree::cfrom(T::native_type),
-		gir_tree::cfrom((int) N),
-		gir_tree::cfrom((int) offset)
-	}));
+	// Members are laid out as in std430
+	offset = gloa_align(offset, T::native_type);
+
+	sub = T(gir_tree::vfrom(ePushConstants, { T::native_type, (int) N, (int) offset }));
 
 	if constexpr (sizeof...(Args) > 0)
-		push_constants_members_proxy(N + 1, offset + gloa_type_offset(T::native_type), args...);
+		push_constants_members_proxy(N + 1, offset + gloa_info_of(T::native_type).size, args...);
 }
 
 template <typename ... Args>
@@ -335,9 +488,10 @@ struct vertex {
 
 // TODO: arithmetic
 // TODO: header
+// Constant operands are folded right away
 inline gir_tree binary_operation(const gir_tree &A, const gir_tree &B, gloa op, gloa rtype)
 {
-	return gir_tree::from(op, A.cexpr & B.cexpr, { gir_tree::cfrom(rtype), A, B });
+	return ceval(gir_tree::from(op, { rtype }, A.cexpr() & B.cexpr(), { A, B }));
 }
 
 // TODO: macrofy
@@ -356,6 +510,21 @@ inline f32 operator*(float A, f32 B)
 	return f32(A) * B;
 }
 
+inline f32 operator/(f32 A, f32 B)
+{
+	return f32(binary_operation(A, B, eDiv, eFloat32));
+}
+
+inline vec3 operator/(vec3 A, f32 B)
+{
+	return vec3(binary_operation(A, B, eDiv, eVec3));
+}
+
+inline vec4 operator/(vec4 A, f32 B)
+{
+	return vec4(binary_operation(A, B, eDiv, eVec4));
+}
+
 inline vec4 operator*(f32 A, vec4 B)
 {
 	return vec4(binary_operation(A, B, eMul, eVec4));
@@ -391,34 +560,6 @@ inline mat3 operator*(mat3 A, mat3 B)
 	return mat3(binary_operation(A, B, eMul, eMat3));
 }
 
-// TODO: math.hpp
-inline vec3 normalize(vec3 v)
-{
-	// TODO: function call wrapper
-	return gir_tree::from(eFunction, v.cexpr, {
-		gir_tree::cfrom(eVec3),
-		gir_tree::cfrom("normalize"), v
-	});
-}
-
-inline f32 dot(vec3 A, vec3 B)
-{
-	// TODO: function call wrapper
-	return f32(gir_tree::from(eFunction, A.cexpr & B.cexpr, {
-		gir_tree::cfrom(eFloat32),
-		gir_tree::cfrom("dot"), A, B
-	}));
-}
-
-inline f32 max(f32 A, f32 B)
-{
-	// TODO: function call wrapper
-	return f32(gir_tree::from(eFunction, A.cexpr & B.cexpr, {
-		gir_tree::cfrom(eFloat32),
-		gir_tree::cfrom("max"), A, B
-	}));
-}
-
 template <typename T, typename U, glcomponents C>
 inline auto operator*(const T &t, const component_ref <U, C> &u)
 {
@@ -2,4 +2,6 @@
 
 #include "fmt.hpp"
 #include "core.hpp"
+#include "math.hpp"
+#include "expr.hpp"
 #include "translate.hpp"
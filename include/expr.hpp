@@ -0,0 +1,264 @@
+#pragma once
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "core.hpp"
+#include "math.hpp"
+
+// Opt-in expression templates; operations on lazy(...) values build typed
+// expression objects on the stack instead of recording GIR per operation, and
+// the whole expression is lowered to GIR once it is converted to a concrete
+// type (e.g. when assigned to a vector or a layout output)
+//
+//	vec4 p = expr::lazy(mvp.proj) * mvp.view * mvp.model * expr::construct <vec4> (position, 1.0f);
+//
+// Result types are those of the eager operators in core.hpp and math.hpp, so
+// an expression only compiles if its eager counterpart does
+namespace expr {
+
+template <typename T>
+concept expression = T::is_expression;
+
+// Concrete GIR type a value stands for
+template <typename T>
+struct concrete {
+	using type = T;
+};
+
+template <typename T, int Binding>
+struct concrete <layout_input <T, Binding>> {
+	using type = T;
+};
+
+template <typename T, int Binding>
+struct concrete <layout_output <T, Binding>> {
+	using type = T;
+};
+
+template <typename T, glcomponents glc>
+struct concrete <component_ref <T, glc>> {
+	using type = typename component_ref <T, glc> ::vtype;
+};
+
+template <typename T, glcomponents ... Cs>
+struct concrete <swizzle_ref <T, Cs...>> {
+	using type = typename swizzle_ref <T, Cs...> ::vtype;
+};
+
+template <typename T>
+using concrete_t = typename concrete <T> ::type;
+
+// Value which has already been recorded (inputs, push constants, ...)
+template <typename T>
+struct leaf {
+	static constexpr bool is_expression = true;
+
+	using type = T;
+
+	T value;
+
+	T lower() const {
+		return value;
+	}
+
+	operator type() const {
+		return lower();
+	}
+};
+
+// Scalar literal; only becomes a node when lowered
+struct literal {
+	static constexpr bool is_expression = true;
+
+	using type = f32;
+
+	float x;
+
+	f32 lower() const {
+		return f32(x);
+	}
+
+	operator type() const {
+		return lower();
+	}
+};
+
+// Constructors take literals as plain floats, as the eager ones do
+template <expression E>
+auto lower_argument(const E &e)
+{
+	return e.lower();
+}
+
+inline float lower_argument(const literal &l)
+{
+	return l.x;
+}
+
+template <typename T>
+constexpr auto lift(const T &x)
+{
+	if constexpr (expression <T>)
+		return x;
+	else if constexpr (std::is_arithmetic_v <T>)
+		return literal { float(x) };
+	else
+		return leaf <concrete_t <T>> { concrete_t <T> (x) };
+}
+
+template <typename T>
+using lifted_t = decltype(lift(std::declval <const T &> ()));
+
+// Entry point of an expression
+template <typename T>
+constexpr auto lazy(const T &x)
+{
+	return lift(x);
+}
+
+template <gloa Op, typename Type, expression A, expression B>
+struct binary {
+	static constexpr bool is_expression = true;
+
+	using type = Type;
+
+	A a;
+	B b;
+
+	type lower() const {
+		return type(binary_operation(a.lower(), b.lower(), Op, type::native_type));
+	}
+
+	operator type() const {
+		return lower();
+	}
+};
+
+// Construction of a vector or matrix from the arguments
+template <typename Type, expression ... Args>
+struct construct_expr {
+	static constexpr bool is_expression = true;
+
+	using type = Type;
+
+	std::tuple <Args...> args;
+
+	type lower() const {
+		return std::apply([](const Args &... args) {
+			return type(lower_argument(args)...);
+		}, args);
+	}
+
+	operator type() const {
+		return lower();
+	}
+};
+
+template <typename Type, typename ... Args>
+constexpr auto construct(const Args &... args)
+{
+	return construct_expr <Type, lifted_t <Args>...> { { lift(args)... } };
+}
+
+// Call to an intrinsic, lowered through its eager overload
+template <typename F, expression ... Args>
+struct call {
+	static constexpr bool is_expression = true;
+
+	using type = decltype(F {} (std::declval <typename Args::type> ()...));
+
+	std::tuple <Args...> args;
+
+	type lower() const {
+		return std::apply([](const Args &... args) {
+			return F {} (args.lower()...);
+		}, args);
+	}
+
+	operator type() const {
+		return lower();
+	}
+};
+
+template <typename A, typename B>
+using product_t = decltype(std::declval <A> () * std::declval <B> ());
+
+template <typename A, typename B>
+using sum_t = decltype(std::declval <A> () + std::declval <B> ());
+
+template <typename A, typename B>
+requires (expression <A> || expression <B>)
+constexpr auto operator*(const A &a, const B &b)
+{
+	using LA = lifted_t <A>;
+	using LB = lifted_t <B>;
+
+	// Literal arithmetic folds at compile time
+	if constexpr (std::is_same_v <LA, literal> && std::is_same_v <LB, literal>)
+		return literal { lift(a).x * lift(b).x };
+	else
+		return binary <eMul, product_t <typename LA::type, typename LB::type>, LA, LB> { lift(a), lift(b) };
+}
+
+template <typename A, typename B>
+requires (expression <A> || expression <B>)
+constexpr auto operator+(const A &a, const B &b)
+{
+	using LA = lifted_t <A>;
+	using LB = lifted_t <B>;
+
+	if constexpr (std::is_same_v <LA, literal> && std::is_same_v <LB, literal>)
+		return literal { lift(a).x + lift(b).x };
+	else
+		return binary <eAdd, sum_t <typename LA::type, typename LB::type>, LA, LB> { lift(a), lift(b) };
+}
+
+// Intrinsics
+struct normalize_fn {
+	auto operator()(const vec3 &v) const {
+		return ::normalize(v);
+	}
+};
+
+struct dot_fn {
+	auto operator()(const vec3 &A, const vec3 &B) const {
+		return ::dot(A, B);
+	}
+};
+
+struct max_fn {
+	auto operator()(const f32 &A, const f32 &B) const {
+		return ::max(A, B);
+	}
+};
+
+template <expression A>
+constexpr auto normalize(const A &a)
+{
+	return call <normalize_fn, A> { { a } };
+}
+
+template <typename A, typename B>
+requires (expression <A> || expression <B>)
+constexpr auto dot(const A &a, const B &b)
+{
+	return call <dot_fn, lifted_t <A>, lifted_t <B>> { { lift(a), lift(b) } };
+}
+
+template <typename A, typename B>
+requires (expression <A> || expression <B>)
+constexpr auto max(const A &a, const B &b)
+{
+	return call <max_fn, lifted_t <A>, lifted_t <B>> { { lift(a), lift(b) } };
+}
+
+// Explicit lowering, e.g. to pass an expression to an eager function
+template <expression E>
+auto lower(const E &e)
+{
+	return e.lower();
+}
+
+}
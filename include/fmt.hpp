@@ -1,38 +1,13 @@
 #pragma once
 
 #include <stack>
+#include <string_view>
 
 #include "gir.hpp"
 #include "translate.hpp"
 
 #include <fmt/format.h>
 
-// TODO: replace the constructor translator/handler with this as a table
-inline std::string gloa_type_string(gloa x)
-{
-	// TODO: unordered map?
-	switch (x) {
-	case eNone:
-		return "";
-	case eFloat32:
-		return "float";
-	case eVec2:
-		return "vec2";
-	case eVec3:
-		return "vec3";
-	case eVec4:
-		return "vec4";
-	case eMat3:
-		return "mat3";
-	case eMat4:
-		return "mat4";
-	default:
-		break;
-	}
-
-	throw fmt::system_error(1, "(cppsl) could not translate type {}", GLOA_STRINGS[x]);
-}
-
 inline std::string format_as(const gir_t &v)
 {
 	struct visitor {
@@ -45,7 +20,7 @@ inline std::string format_as(const gir_t &v)
 		}
 
 		std::string operator()(gloa x) {
-			return GLOA_STRINGS[x];
+			return gloa_info_of(x).name;
 		}
 
 		std::string operator()(const std::string &x) {
@@ -53,7 +28,17 @@ inline std::string format_as(const gir_t &v)
 		}
 	};
 
-	return std::visit(visitor {}, v);
+	return v.visit(visitor {});
+}
+
+inline std::string format_as(const gir_header &h)
+{
+	std::string out = gloa_info_of(h.type).name;
+	if (h.index >= 0)
+		out += fmt::format(" #{}", h.index);
+	if (h.offset >= 0)
+		out += fmt::format(" +{}", h.offset);
+	return out;
 }
 
 inline std::string format_as(const gir_tree &gt, size_t indent = 0)
@@ -61,15 +46,15 @@ inline std::string format_as(const gir_tree &gt, size_t indent = 0)
 	std::string tab(indent, ' ');
 
 	std::string variant = "int";
-	if (std::holds_alternative <float> (gt.data))
+	if (gt.data().holds <float> ())
 		variant = "float";
-	if (std::holds_alternative <gloa> (gt.data))
+	if (gt.data().holds <gloa> ())
 		variant = "gloa";
-	if (std::holds_alternative <std::string> (gt.data))
+	if (gt.data().holds <std::string> ())
 		variant = "string";
 
-	std::string out = fmt::format("{}({:>7s}: {}: {})", tab, variant, gt.data, gt.cexpr);
-	for (const auto &cgt : gt.children)
+	std::string out = fmt::format("{}({:>7s}: {}: {}: {})", tab, variant, gt.data(), gt.header(), gt.cexpr());
+	for (const auto &cgt : gt.children())
 		out += "\n" + format_as(cgt, indent + 4);
 	return out;
 }
@@ -87,11 +72,11 @@ inline std::string format_as(const gcir_graph &gcir)
 		const gir_t &data = gcir.data[r];
 
 		std::string variant = "int";
-		if (std::holds_alternative <float> (data))
+		if (data.holds <float> ())
 			variant = "float";
-		if (std::holds_alternative <gloa> (data))
+		if (data.holds <gloa> ())
 			variant = "gloa";
-		if (std::holds_alternative <std::string> (data))
+		if (data.holds <std::string> ())
 			variant = "string";
 
 		std::string rs = "";
@@ -106,7 +91,7 @@ inline std::string format_as(const gcir_graph &gcir)
 
 		std::string tab(t, ' ');
 		// out += fmt::format("{:>3}: {}[{:>7s} | {} | {}]\n", r, tab, variant, data, rs);
-		out += fmt::format("{:>3}: {}[{} | {}]\n", r, tab, data, rs);
+		out += fmt::format("{:>3}: {}[{} : {} | {}]\n", r, tab, data, gcir.headers[r], rs);
 
 		// Add child reference in reverse order
 		for (auto rc = gcir.refs[r].rbegin(); rc != gcir.refs[r].rend(); rc++)
@@ -118,17 +103,31 @@ inline std::string format_as(const gcir_graph &gcir)
 
 inline std::string format_as(const statement &s)
 {
-	std::string type = gloa_type_string(s.loc.type);
+	std::string_view type = gloa_info_of(s.loc.type).glsl;
 	if (type.empty())
 		return s.loc.full_id() + " = " + s.source + ";";
 
-	return gloa_type_string(s.loc.type) + " " + s.loc.full_id() + " = " + s.source + ";";
+	return std::string(type) + " " + s.loc.full_id() + " = " + s.source + ";";
 }
 
-inline std::string format_as(const std::vector <statement> &statements)
+inline std::string format_as(const statement_list &statements)
 {
 	std::string out = "";
 	for (const auto &s : statements)
 		out += fmt::format("{}", s) + "\n";
 	return out;
 }
+
+inline std::string format_as(const pass_stats &ps)
+{
+	return fmt::format("{:<12} {:>4} -> {:>4} nodes ({:+}), {} folded in {:.3f} ms ({} runs)",
+		ps.name, ps.nodes_before, ps.nodes_after, ps.delta, ps.folded, ps.milliseconds, ps.runs);
+}
+
+inline std::string format_as(const translation_report &report)
+{
+	return fmt::format("{} -> {} nodes ({:.1f}% merged), {} folded, {} statements ({} temporaries), "
+		"cost {} ALU + {} transcendental",
+		report.tree_nodes, report.graph_nodes, 100.0 * report.cse_hit_rate, report.folded_constants,
+		report.statements, report.temporaries, report.alu_cost, report.transcendental_cost);
+}
@@ -1,17 +1,24 @@
 #pragma once
 
-#include <variant>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <initializer_list>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <fmt/format.h>
 
+#include "small_vector.hpp"
+
 // GLSL Operations/Annotations
 enum gloa : int {
 	// Read and write operations
-	eConstruct, eIndex, eComponent,
-
-	// Invoke function
-	eFunction,
+	eConstruct, eIndex, eComponent, eInsert,
 
 	// Types
 	eNone, eInt32, eFloat32,
@@ -24,82 +31,497 @@ enum gloa : int {
 	ePushConstants,
 
 	// Arithmetic
-	eAdd, eSub, eMul, eDiv,
+	eAdd, eSub, eMul, eDiv, eNeg,
+
+	// Math built-ins (GLSL.std.450)
+	eAbs, eSign, eFloor, eCeil, eFract,
+	eSqrt, eInverseSqrt, eExp, eExp2, eLog, eLog2,
+	eSin, eCos, eTan,
+	eMin, eMax, eClamp, eMix, eStep, eSmoothstep, ePow, eFma,
+	eDot, eCross, eLength, eDistance, eNormalize, eReflect,
 
 	// Instrinsics
 	eGlPosition
 };
 
-static constexpr const char *GLOA_STRINGS[] {
-	"Construct", "Index", "Component",
+// How the stages treat each gloa; selects the handler in ceval and translation
+enum class gloa_handler : uint8_t {
+	eType,
+	eList,
+	eConstruct,
+	eComponent,
+	eInsert,
+	eIntrinsic,
+	eLayoutInput,
+	eLayoutOutput,
+	ePushConstants,
+	eBinary,
+	eBuiltinOutput,
+	eUnary,
+	eUnsupported,
+};
+
+// Everything known about a gloa, as one row per enumerator
+struct gloa_info {
+	gloa id;
+
+	const char *name;
+
+	// GLSL spelling; type name, operator symbol or builtin variable
+	const char *glsl;
+
+	// Size and alignment (std430, as for push constants) in bytes
+	uint32_t size;
+	uint32_t alignment;
+
+	// Components of a type and the scalar type of each
+	uint32_t components;
+	gloa scalar;
+
+	// Number of operands; -1 if variadic
+	int arity;
+
+	gloa_handler handler;
+
+	// Rough cost of evaluating per invocation, in ALU operations
+	uint32_t cost;
+};
+
+static constexpr gloa_info GLOA_TABLE[] {
+	{ eConstruct,     "Construct",     "",             0,  0,  0, eNone,    -1, gloa_handler::eConstruct,      0 },
+	{ eIndex,         "Index",         "",             0,  0,  0, eNone,     2, gloa_handler::eUnsupported,    1 },
+	{ eComponent,     "Component",     "",             0,  0,  0, eNone,     1, gloa_handler::eComponent,      0 },
+	{ eInsert,        "Insert",        "",             0,  0,  0, eNone,     2, gloa_handler::eInsert,         0 },
 
-	"Function",
+	{ eNone,          "None",          "",             0,  0,  0, eNone,    -1, gloa_handler::eList,           0 },
+	{ eInt32,         "Int32",         "int",          4,  4,  1, eInt32,    0, gloa_handler::eType,           0 },
+	{ eFloat32,       "Float32",       "float",        4,  4,  1, eFloat32,  0, gloa_handler::eType,           0 },
+	{ eVec2,          "Vec2",          "vec2",         8,  8,  2, eFloat32,  0, gloa_handler::eType,           0 },
+	{ eVec3,          "Vec3",          "vec3",        12, 16,  3, eFloat32,  0, gloa_handler::eType,           0 },
+	{ eVec4,          "Vec4",          "vec4",        16, 16,  4, eFloat32,  0, gloa_handler::eType,           0 },
+	{ eMat2,          "Mat2",          "mat2",        16,  8,  4, eFloat32,  0, gloa_handler::eType,           0 },
+	{ eMat3,          "Mat3",          "mat3",        48, 16,  9, eFloat32,  0, gloa_handler::eType,           0 },
+	{ eMat4,          "Mat4",          "mat4",        64, 16, 16, eFloat32,  0, gloa_handler::eType,           0 },
 
-	"None", "Int32", "Float32",
-	"Vec2", "Vec3", "Vec4",
-	"Mat2", "Mat3", "Mat4",
+	{ eLayoutInput,   "LayoutInput",   "_lin",         0,  0,  0, eNone,     0, gloa_handler::eLayoutInput,    0 },
+	{ eLayoutOutput,  "LayoutOutput",  "_lout",        0,  0,  0, eNone,     1, gloa_handler::eLayoutOutput,   0 },
+	{ ePushConstants, "PushConstants", "_pc",          0,  0,  0, eNone,     0, gloa_handler::ePushConstants,  0 },
 
-	"LayoutInput",
-	"LayoutOutput",
-	"PushConstants",
+	{ eAdd,           "Add",           "+",            0,  0,  0, eNone,     2, gloa_handler::eBinary,         1 },
+	{ eSub,           "Sub",           "-",            0,  0,  0, eNone,     2, gloa_handler::eBinary,         1 },
+	{ eMul,           "Mul",           "*",            0,  0,  0, eNone,     2, gloa_handler::eBinary,         1 },
+	{ eDiv,           "Div",           "/",            0,  0,  0, eNone,     2, gloa_handler::eBinary,         4 },
+	{ eNeg,           "Neg",           "-",            0,  0,  0, eNone,     1, gloa_handler::eUnary,          1 },
 
-	"Add", "Sub", "Mul", "Div",
+	{ eAbs,           "Abs",           "abs",          0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      1 },
+	{ eSign,          "Sign",          "sign",         0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      1 },
+	{ eFloor,         "Floor",         "floor",        0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      1 },
+	{ eCeil,          "Ceil",          "ceil",         0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      1 },
+	{ eFract,         "Fract",         "fract",        0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      1 },
+	{ eSqrt,          "Sqrt",          "sqrt",         0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      4 },
+	{ eInverseSqrt,   "InverseSqrt",   "inversesqrt",  0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      4 },
+	{ eExp,           "Exp",           "exp",          0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      8 },
+	{ eExp2,          "Exp2",          "exp2",         0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      4 },
+	{ eLog,           "Log",           "log",          0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      8 },
+	{ eLog2,          "Log2",          "log2",         0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      4 },
+	{ eSin,           "Sin",           "sin",          0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      8 },
+	{ eCos,           "Cos",           "cos",          0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      8 },
+	{ eTan,           "Tan",           "tan",          0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,     16 },
+	{ eMin,           "Min",           "min",          0,  0,  0, eNone,     2, gloa_handler::eIntrinsic,      1 },
+	{ eMax,           "Max",           "max",          0,  0,  0, eNone,     2, gloa_handler::eIntrinsic,      1 },
+	{ eClamp,         "Clamp",         "clamp",        0,  0,  0, eNone,     3, gloa_handler::eIntrinsic,      2 },
+	{ eMix,           "Mix",           "mix",          0,  0,  0, eNone,     3, gloa_handler::eIntrinsic,      2 },
+	{ eStep,          "Step",          "step",         0,  0,  0, eNone,     2, gloa_handler::eIntrinsic,      1 },
+	{ eSmoothstep,    "Smoothstep",    "smoothstep",   0,  0,  0, eNone,     3, gloa_handler::eIntrinsic,      6 },
+	{ ePow,           "Pow",           "pow",          0,  0,  0, eNone,     2, gloa_handler::eIntrinsic,     16 },
+	{ eFma,           "Fma",           "fma",          0,  0,  0, eNone,     3, gloa_handler::eIntrinsic,      1 },
+	{ eDot,           "Dot",           "dot",          0,  0,  0, eNone,     2, gloa_handler::eIntrinsic,      3 },
+	{ eCross,         "Cross",         "cross",        0,  0,  0, eNone,     2, gloa_handler::eIntrinsic,      6 },
+	{ eLength,        "Length",        "length",       0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      7 },
+	{ eDistance,      "Distance",      "distance",     0,  0,  0, eNone,     2, gloa_handler::eIntrinsic,      8 },
+	{ eNormalize,     "Normalize",     "normalize",    0,  0,  0, eNone,     1, gloa_handler::eIntrinsic,      8 },
+	{ eReflect,       "Reflect",       "reflect",      0,  0,  0, eNone,     2, gloa_handler::eIntrinsic,      6 },
 
-	"gl_Position"
+	{ eGlPosition,    "gl_Position",   "gl_Position",  0,  0,  0, eNone,     1, gloa_handler::eBuiltinOutput,  0 },
 };
 
-// TODO: size information as well...
-constexpr size_t gloa_type_offset(gloa x)
+// Rows must stay in enumerator order, so that lookups are plain indexing
+constexpr bool gloa_table_ordered()
+{
+	for (size_t i = 0; i < std::size(GLOA_TABLE); i++) {
+		if (GLOA_TABLE[i].id != gloa(i))
+			return false;
+	}
+
+	return std::size(GLOA_TABLE) == eGlPosition + 1;
+}
+
+static_assert(gloa_table_ordered());
+
+constexpr const gloa_info &gloa_info_of(gloa x)
+{
+	return GLOA_TABLE[x];
+}
+
+// Operations run by (or involving, as for normalize) the special function
+// units, rather than the main ALUs
+constexpr bool gloa_transcendental(gloa x)
 {
-	// NOTE: this is not the same as the actual size
 	switch (x) {
-	case eVec3:
-	case eVec4:
-		return 4 * sizeof(float);
-	case eMat4:
-		return 16 * sizeof(float);
+	case eSqrt: case eInverseSqrt: case eExp: case eExp2: case eLog: case eLog2:
+	case eSin: case eCos: case eTan: case ePow:
+	case eLength: case eDistance: case eNormalize:
+		return true;
 	default:
-		break;
+		return false;
+	}
+}
+
+// Offset of a value of the given type placed at or after offset
+constexpr size_t gloa_align(size_t offset, gloa x)
+{
+	const gloa_info &info = gloa_info_of(x);
+	if (info.handler != gloa_handler::eType || info.alignment == 0)
+		throw fmt::system_error(1, "(cppsl) type {} has no layout", info.name);
+
+	return (offset + info.alignment - 1) / info.alignment * info.alignment;
+}
+
+// Interned strings (e.g. function names) referenced by atoms
+struct gir_strings {
+	// NOTE: a deque so that references to names survive further interning
+	std::deque <std::string> names;
+	std::unordered_map <std::string, uint32_t> ids;
+
+	uint32_t intern(const std::string &);
+
+	const std::string &name(uint32_t id) const {
+		return names[id];
+	}
+
+	// Forgetting every name interned after the first count of them
+	void truncate(size_t);
+
+	static gir_strings &active();
+};
+
+// Alternatives of an atom
+enum class gir_tag : uint32_t {
+	Int, Float, Gloa, String
+};
+
+// GLSL Intermediate Representation (atom); a tag and a 32-bit payload, so
+// that comparing or hashing atoms is a single integer operation
+struct gir_t {
+	gir_tag tag;
+	uint32_t payload;
+
+	gir_t(int x) : tag(gir_tag::Int), payload(std::bit_cast <uint32_t> (x)) {}
+	gir_t(float x) : tag(gir_tag::Float), payload(std::bit_cast <uint32_t> (x)) {}
+	gir_t(gloa x) : tag(gir_tag::Gloa), payload(x) {}
+	gir_t(const std::string &x) : tag(gir_tag::String), payload(gir_strings::active().intern(x)) {}
+	gir_t(const char *x) : gir_t(std::string(x)) {}
+
+	template <typename T>
+	bool holds() const {
+		if constexpr (std::is_same_v <T, int>)
+			return tag == gir_tag::Int;
+		else if constexpr (std::is_same_v <T, float>)
+			return tag == gir_tag::Float;
+		else if constexpr (std::is_same_v <T, gloa>)
+			return tag == gir_tag::Gloa;
+		else
+			return tag == gir_tag::String;
+	}
+
+	template <typename T>
+	decltype(auto) get() const {
+		assert(holds <T> ());
+		if constexpr (std::is_same_v <T, int>)
+			return std::bit_cast <int> (payload);
+		else if constexpr (std::is_same_v <T, float>)
+			return std::bit_cast <float> (payload);
+		else if constexpr (std::is_same_v <T, gloa>)
+			return gloa(payload);
+		else
+			return gir_strings::active().name(payload);
+	}
+
+	// Invoke the visitor with the held alternative
+	template <typename F>
+	decltype(auto) visit(F &&ftn) const {
+		switch (tag) {
+		case gir_tag::Int:
+			return ftn(get <int> ());
+		case gir_tag::Float:
+			return ftn(get <float> ());
+		case gir_tag::Gloa:
+			return ftn(get <gloa> ());
+		default:
+			break;
+		}
+
+		return ftn(get <std::string> ());
+	}
+
+	uint64_t bits() const {
+		return (uint64_t(tag) << 32) | payload;
+	}
+
+	bool operator==(const gir_t &other) const {
+		return bits() == other.bits();
+	}
+};
+
+static_assert(sizeof(gir_t) == 8);
+
+template <>
+struct std::hash <gir_t> {
+	size_t operator()(const gir_t &x) const {
+		return std::hash <uint64_t> {} (x.bits());
+	}
+};
+
+// Metadata stored in the node itself rather than as leaf children
+struct gir_header {
+	// Result type of the expression
+	gloa type = eNone;
+
+	// Binding (layouts), member (push constants) or swizzle mask (accesses)
+	int index = -1;
+
+	// Byte offset (push constants)
+	int offset = -1;
+
+	bool operator==(const gir_header &) const = default;
+
+	// Header of a literal, deduced from the atom
+	static gir_header of(const gir_t &);
+};
+
+template <>
+struct std::hash <gir_header> {
+	size_t operator()(const gir_header &h) const {
+		uint64_t packed = (uint64_t(uint32_t(h.index)) << 32) | uint32_t(h.offset);
+		return std::hash <uint64_t> {} (packed) ^ (size_t(h.type) << 1);
+	}
+};
+
+// Swizzle masks pack up to four 2-bit component indices, followed by the
+// component count minus one; a single component is its plain index
+constexpr int swizzle_mask(std::initializer_list <int> components)
+{
+	int mask = int(components.size() - 1) << 8;
+	int shift = 0;
+	for (int c : components) {
+		mask |= c << shift;
+		shift += 2;
 	}
 
-	throw fmt::system_error(1, "(cppsl) unknown type {} for offset", GLOA_STRINGS[x]);
+	return mask;
+}
+
+constexpr int swizzle_size(int mask)
+{
+	return (mask >> 8) + 1;
+}
+
+constexpr int swizzle_component(int mask, int i)
+{
+	return (mask >> (2 * i)) & 0b11;
+}
+
+// Components touched by a swizzle, as a bitset
+constexpr int swizzle_coverage(int mask)
+{
+	int bits = 0;
+	for (int i = 0; i < swizzle_size(mask); i++)
+		bits |= 1 << swizzle_component(mask, i);
+
+	return bits;
+}
+
+// Whether the swizzle can be written to, i.e. names no component twice
+constexpr bool swizzle_writable(int mask)
+{
+	return std::popcount(unsigned(swizzle_coverage(mask))) == swizzle_size(mask);
 }
 
-// GLSL Intermediate Representation (atom)
-using gir_t = std::variant <int, float, gloa, std::string>;
+struct gir_node;
+struct gir_tree;
 
-// GLSL Intermediate Representation (tree)
+// Children of a node; at most four for everything but matrix constructs and
+// the output list, so the common case never touches the heap
+using gir_children = small_vector <gir_tree, 4>;
+
+// GLSL Intermediate Representation (tree); a handle to an interned node, so
+// that structurally identical subtrees are only ever stored once
 struct gir_tree {
+	// Index of the node in the thread's arena
+	int index = -1;
+
+	// Node contents
+	const gir_node &node() const;
+
+	const gir_t &data() const;
+	const gir_header &header() const;
+	bool cexpr() const;
+	const gir_children &children() const;
+
+	// Replace contents
+	void rehash(gir_t, const gir_header &, bool, const gir_children &);
+	void rehash(gir_t, const gir_header &, bool, gir_children && = {});
+
+	// Literals (header deduced from the atom)
+	static gir_tree from(gir_t, bool);
+	static gir_tree cfrom(gir_t);
+	static gir_tree vfrom(gir_t);
+
+	// Operations
+	static gir_tree from(gir_t, const gir_header &, bool, const gir_children &);
+	static gir_tree from(gir_t, const gir_header &, bool, gir_children && = {});
+
+	static gir_tree cfrom(gir_t, const gir_header &, const gir_children &);
+	static gir_tree cfrom(gir_t, const gir_header &, gir_children && = {});
+
+	static gir_tree vfrom(gir_t, const gir_header &, const gir_children &);
+	static gir_tree vfrom(gir_t, const gir_header &, gir_children && = {});
+};
+
+// Contents of a GIR node
+struct gir_node {
 	// Packet of data
 	gir_t data;
 
+	// Result type, binding and offset
+	gir_header header;
+
 	// Indicates whether the expression is constant
 	bool cexpr;
 
 	// Dependencies of the expression (i.e. expression tree)
-	std::vector <gir_tree> children;
+	gir_children children;
 
-	// Replace contents
-	void rehash(gir_t, bool, const std::vector <gir_tree> &);
+	bool operator==(const gir_node &) const;
+};
 
-	static gir_tree from(gir_t, bool);
-	static gir_tree from(gir_t, bool, const std::vector <gir_tree> &);
+// Hash-consing arena of GIR nodes; each thread records into its own arena
+struct gir_arena {
+	// Children lists too long to be kept inline, recycled as nodes are
+	// released rather than returned to the heap each translation
+	std::pmr::unsynchronized_pool_resource spills;
 
-	static gir_tree cfrom(gir_t);
-	static gir_tree cfrom(gir_t, const std::vector <gir_tree> &);
+	// NOTE: a deque so that references to nodes survive further interning
+	std::deque <gir_node> nodes;
 
-	static gir_tree vfrom(gir_t);
-	static gir_tree vfrom(gir_t, const std::vector <gir_tree> &);
+	// Structural hash to the indices of all nodes with that hash
+	std::unordered_multimap <size_t, int> table;
+
+	// Find or insert a node with the given contents
+	int intern(gir_node &&);
+
+	// Releasing every node interned after the first count of them
+	void truncate(size_t);
+
+	static gir_arena &active();
 };
 
+// Scope of one translation; nodes, names and folded values interned within it
+// are released when it ends, while trees created before it remain valid.
+// NOTE: no tree created inside a scope may outlive it (e.g. in a static), so
+// shaders are recorded before opening one; only the passes run within it
+struct gir_scope {
+	size_t nodes;
+	size_t names;
+
+	gir_scope();
+	~gir_scope();
+
+	gir_scope(const gir_scope &) = delete;
+	gir_scope &operator=(const gir_scope &) = delete;
+};
+
+inline const gir_node &gir_tree::node() const
+{
+	// Otherwise released with the scope it was created in
+	assert(size_t(index) < gir_arena::active().nodes.size());
+	return gir_arena::active().nodes[index];
+}
+
+inline const gir_t &gir_tree::data() const
+{
+	return node().data;
+}
+
+inline const gir_header &gir_tree::header() const
+{
+	return node().header;
+}
+
+inline bool gir_tree::cexpr() const
+{
+	return node().cexpr;
+}
+
+inline const gir_children &gir_tree::children() const
+{
+	return node().children;
+}
+
 // Performing constant expression simplifications
 gir_tree ceval(const gir_tree &);
 
-// GLSL Compressed Intermediate Representation (graph)
+// Dropping folded values of nodes past the first count, or folded into them
+void ceval_truncate(size_t);
+
+// Operations ceval has evaluated on this thread; the difference between two
+// calls counts the folds in between
+size_t ceval_folds();
+
+// Rewriting into cheaper but less exact forms (e.g. normalize through
+// inversesqrt, divisions as reciprocal multiplications)
+gir_tree fast_math(const gir_tree &, std::pmr::memory_resource * = std::pmr::get_default_resource());
+
+// Reordering chains of matrix products into their cheapest evaluation order;
+// products which are needed elsewhere anyway are reused, and products of
+// push constants only are (nearly) free if they are to be hoisted
+gir_tree reassociate(const gir_tree &, std::pmr::memory_resource * = std::pmr::get_default_resource(), bool = false);
+
+// Local algebraic rewrites (identities, negation, fma contraction and exact
+// reciprocals); with fast math, also those wrong for non-finite operands
+gir_tree peephole(const gir_tree &, std::pmr::memory_resource * = std::pmr::get_default_resource(), bool = false);
+
+// Packing isomorphic scalar operations on components into vector operations
+gir_tree vectorize(const gir_tree &, std::pmr::memory_resource * = std::pmr::get_default_resource());
+
+// GLSL Compressed Intermediate Representation (graph); all storage comes from
+// a single memory resource, typically the arena of one translation
+using gcir_refs = small_vector <int, 4>;
+
 struct gcir_graph {
-	std::vector <gir_t> data;
-	std::vector <std::vector <int>> refs;
+	std::pmr::vector <gir_t> data;
+	std::pmr::vector <gir_header> headers;
+	std::pmr::vector <gcir_refs> refs;
+
+	explicit gcir_graph(std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+			: data(resource), headers(resource), refs(resource) {}
+
+	std::pmr::memory_resource *resource() const {
+		return data.get_allocator().resource();
+	}
 };
 
-// Compressing GIR into GCIR
-gcir_graph compress(const gir_tree &);
+// Compressing GIR into GCIR; interned nodes are emitted once
+gcir_graph compress(const gir_tree &, std::pmr::memory_resource * = std::pmr::get_default_resource());
+
+// Expanding GCIR back into (interned) GIR; whole, or a single node with the
+// nodes expanded so far
+gir_tree expand(const gcir_graph &);
+gir_tree expand(const gcir_graph &, int, std::pmr::vector <int> &);
+
+// Merging structurally equivalent nodes of a GCIR
+gcir_graph deduplicate(const gcir_graph &);
+
+// Evaluating the items of a GCIR list on the CPU, reading push constants from
+// one std430 block and writing each item at its offset in another
+void ceval_program(const gcir_graph &, const std::vector <int> &, const void *, void *);
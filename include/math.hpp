@@ -0,0 +1,159 @@
+#pragma once
+
+#include <concepts>
+#include <type_traits>
+
+#include "core.hpp"
+
+// Math built-ins (GLSL.std.450), recorded as typed intrinsic nodes; calls on
+// constant operands are folded right away by ceval
+template <typename R, typename ... Args>
+R intrinsic(gloa op, const Args &... args)
+{
+	bool cexpr = (args.cexpr() & ...);
+	return R(ceval(gir_tree::from(op, { R::native_type }, cexpr, { args... })));
+}
+
+// Overloads for each of GLSL's genType (float, vec2, vec3, vec4)
+#define CPPSL_INTRINSIC_1(name, op)						\
+	inline f32 name(const f32 &x) { return intrinsic <f32> (op, x); }	\
+	inline vec2 name(const vec2 &x) { return intrinsic <vec2> (op, x); }	\
+	inline vec3 name(const vec3 &x) { return intrinsic <vec3> (op, x); }	\
+	inline vec4 name(const vec4 &x) { return intrinsic <vec4> (op, x); }
+
+#define CPPSL_INTRINSIC_2(name, op)									\
+	inline f32 name(const f32 &x, const f32 &y) { return intrinsic <f32> (op, x, y); }		\
+	inline vec2 name(const vec2 &x, const vec2 &y) { return intrinsic <vec2> (op, x, y); }	\
+	inline vec3 name(const vec3 &x, const vec3 &y) { return intrinsic <vec3> (op, x, y); }	\
+	inline vec4 name(const vec4 &x, const vec4 &y) { return intrinsic <vec4> (op, x, y); }
+
+// GLSL's forms taking a float where the others take a genType, with the float
+// splatted to every component; otherwise the float would silently become a
+// vector through the vector constructors, e.g. vec3(x, 0, 0)
+template <typename S>
+concept scalar_operand = std::convertible_to <const S &, f32>;
+
+template <typename T>
+T splat(const f32 &x)
+{
+	if constexpr (std::is_same_v <T, f32>)
+		return x;
+	else if constexpr (std::is_same_v <T, vec2>)
+		return vec2(x, x);
+	else if constexpr (std::is_same_v <T, vec3>)
+		return vec3(x, x, x);
+	else
+		return vec4(x, x, x, x);
+}
+
+// name(genType, float)
+#define CPPSL_INTRINSIC_2_FLOAT_LAST_TYPE(name, op, T)						\
+	template <scalar_operand S>								\
+	inline T name(const T &x, const S &y) { return intrinsic <T> (op, x, splat <T> (y)); }
+
+// name(float, genType)
+#define CPPSL_INTRINSIC_2_FLOAT_FIRST_TYPE(name, op, T)						\
+	template <scalar_operand S>								\
+	inline T name(const S &x, const T &y) { return intrinsic <T> (op, splat <T> (x), y); }
+
+// name(genType, float, float)
+#define CPPSL_INTRINSIC_3_FLOAT_LAST_TYPE(name, op, T)						\
+	template <scalar_operand S, scalar_operand U>						\
+	inline T name(const T &x, const S &y, const U &z)					\
+		{ return intrinsic <T> (op, x, splat <T> (y), splat <T> (z)); }
+
+// name(genType, genType, float)
+#define CPPSL_INTRINSIC_3_FLOAT_THIRD_TYPE(name, op, T)						\
+	template <scalar_operand S>								\
+	inline T name(const T &x, const T &y, const S &z)					\
+		{ return intrinsic <T> (op, x, y, splat <T> (z)); }
+
+// name(float, float, genType)
+#define CPPSL_INTRINSIC_3_FLOAT_FIRST_TYPE(name, op, T)						\
+	template <scalar_operand S, scalar_operand U>						\
+	inline T name(const S &x, const U &y, const T &z)					\
+		{ return intrinsic <T> (op, splat <T> (x), splat <T> (y), z); }
+
+// Every genType, so that scalars mixed with f32 still find an exact match
+#define CPPSL_INTRINSIC_FLOAT_FORMS(form, name, op)	\
+	form(name, op, f32)				\
+	form(name, op, vec2)				\
+	form(name, op, vec3)				\
+	form(name, op, vec4)
+
+#define CPPSL_INTRINSIC_3(name, op)												\
+	inline f32 name(const f32 &x, const f32 &y, const f32 &z) { return intrinsic <f32> (op, x, y, z); }		\
+	inline vec2 name(const vec2 &x, const vec2 &y, const vec2 &z) { return intrinsic <vec2> (op, x, y, z); }	\
+	inline vec3 name(const vec3 &x, const vec3 &y, const vec3 &z) { return intrinsic <vec3> (op, x, y, z); }	\
+	inline vec4 name(const vec4 &x, const vec4 &y, const vec4 &z) { return intrinsic <vec4> (op, x, y, z); }
+
+// Reductions to a scalar
+#define CPPSL_INTRINSIC_SCALAR_1(name, op)						\
+	inline f32 name(const f32 &x) { return intrinsic <f32> (op, x); }		\
+	inline f32 name(const vec2 &x) { return intrinsic <f32> (op, x); }		\
+	inline f32 name(const vec3 &x) { return intrinsic <f32> (op, x); }		\
+	inline f32 name(const vec4 &x) { return intrinsic <f32> (op, x); }
+
+#define CPPSL_INTRINSIC_SCALAR_2(name, op)								\
+	inline f32 name(const f32 &x, const f32 &y) { return intrinsic <f32> (op, x, y); }	\
+	inline f32 name(const vec2 &x, const vec2 &y) { return intrinsic <f32> (op, x, y); }	\
+	inline f32 name(const vec3 &x, const vec3 &y) { return intrinsic <f32> (op, x, y); }	\
+	inline f32 name(const vec4 &x, const vec4 &y) { return intrinsic <f32> (op, x, y); }
+
+CPPSL_INTRINSIC_1(abs, eAbs)
+CPPSL_INTRINSIC_1(sign, eSign)
+CPPSL_INTRINSIC_1(floor, eFloor)
+CPPSL_INTRINSIC_1(ceil, eCeil)
+CPPSL_INTRINSIC_1(fract, eFract)
+CPPSL_INTRINSIC_1(sqrt, eSqrt)
+CPPSL_INTRINSIC_1(inversesqrt, eInverseSqrt)
+CPPSL_INTRINSIC_1(exp, eExp)
+CPPSL_INTRINSIC_1(exp2, eExp2)
+CPPSL_INTRINSIC_1(log, eLog)
+CPPSL_INTRINSIC_1(log2, eLog2)
+CPPSL_INTRINSIC_1(sin, eSin)
+CPPSL_INTRINSIC_1(cos, eCos)
+CPPSL_INTRINSIC_1(tan, eTan)
+CPPSL_INTRINSIC_1(normalize, eNormalize)
+
+CPPSL_INTRINSIC_2(min, eMin)
+CPPSL_INTRINSIC_2(max, eMax)
+CPPSL_INTRINSIC_2(step, eStep)
+CPPSL_INTRINSIC_2(pow, ePow)
+CPPSL_INTRINSIC_2(reflect, eReflect)
+
+CPPSL_INTRINSIC_3(clamp, eClamp)
+CPPSL_INTRINSIC_3(mix, eMix)
+CPPSL_INTRINSIC_3(smoothstep, eSmoothstep)
+CPPSL_INTRINSIC_3(fma, eFma)
+
+CPPSL_INTRINSIC_FLOAT_FORMS(CPPSL_INTRINSIC_2_FLOAT_LAST_TYPE, min, eMin)
+CPPSL_INTRINSIC_FLOAT_FORMS(CPPSL_INTRINSIC_2_FLOAT_LAST_TYPE, max, eMax)
+CPPSL_INTRINSIC_FLOAT_FORMS(CPPSL_INTRINSIC_2_FLOAT_LAST_TYPE, pow, ePow)
+CPPSL_INTRINSIC_FLOAT_FORMS(CPPSL_INTRINSIC_2_FLOAT_FIRST_TYPE, step, eStep)
+
+CPPSL_INTRINSIC_FLOAT_FORMS(CPPSL_INTRINSIC_3_FLOAT_LAST_TYPE, clamp, eClamp)
+CPPSL_INTRINSIC_FLOAT_FORMS(CPPSL_INTRINSIC_3_FLOAT_THIRD_TYPE, mix, eMix)
+CPPSL_INTRINSIC_FLOAT_FORMS(CPPSL_INTRINSIC_3_FLOAT_FIRST_TYPE, smoothstep, eSmoothstep)
+
+CPPSL_INTRINSIC_SCALAR_1(length, eLength)
+
+CPPSL_INTRINSIC_SCALAR_2(dot, eDot)
+CPPSL_INTRINSIC_SCALAR_2(distance, eDistance)
+
+inline vec3 cross(const vec3 &x, const vec3 &y)
+{
+	return intrinsic <vec3> (eCross, x, y);
+}
+
+#undef CPPSL_INTRINSIC_1
+#undef CPPSL_INTRINSIC_2
+#undef CPPSL_INTRINSIC_3
+#undef CPPSL_INTRINSIC_2_FLOAT_LAST_TYPE
+#undef CPPSL_INTRINSIC_2_FLOAT_FIRST_TYPE
+#undef CPPSL_INTRINSIC_3_FLOAT_LAST_TYPE
+#undef CPPSL_INTRINSIC_3_FLOAT_THIRD_TYPE
+#undef CPPSL_INTRINSIC_3_FLOAT_FIRST_TYPE
+#undef CPPSL_INTRINSIC_FLOAT_FORMS
+#undef CPPSL_INTRINSIC_SCALAR_1
+#undef CPPSL_INTRINSIC_SCALAR_2
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include "gir.hpp"
+
+// Optimization levels; -O0 translates as recorded, -O1 runs every pass once
+// and -O2 iterates them to a fixed point
+enum class opt_level : int {
+	O0, O1, O2
+};
+
+// Knobs of a translation
+struct translation_options {
+	opt_level level = opt_level::O2;
+
+	// Cheaper lowerings of intrinsics and divisions, at the cost of exactness
+	bool fast_math = false;
+
+	// Computations on push constants alone move to the CPU; this changes the
+	// push constants block, which must then be filled by
+	// linked_translation::uniforms, shared by both stages; only for
+	// translate_linked
+	bool hoist_uniforms = false;
+
+	// Varyings narrower than a vec4 share locations, packed by the vertex
+	// shader and unpacked by the fragment shader; only for translate_linked
+	bool pack_varyings = false;
+
+	// Cheap values (swizzles and negations of inputs, constant vectors) are
+	// recomputed at each use rather than kept live in a temporary
+	bool rematerialize = false;
+
+	// Filling translation::report
+	bool report = false;
+
+	// Printing the final graph and source of each translation
+	bool verbose = false;
+};
+
+// Effect of one pass over a translation, accumulated across iterations
+struct pass_stats {
+	std::string_view name;
+
+	// Graph sizes around the first and last runs
+	size_t nodes_before = 0;
+	size_t nodes_after = 0;
+
+	// Nodes added (positive) or removed by the pass itself, over all runs
+	long delta = 0;
+
+	// Operations on constants evaluated during the pass, over all runs
+	size_t folded = 0;
+
+	double milliseconds = 0.0;
+
+	int runs = 0;
+};
+
+// Summary of a translation, for reviewing changes to shaders
+struct translation_report {
+	// Recorded nodes, counting shared subtrees at each use, and distinct
+	// nodes once compressed; the difference is what interning merged
+	size_t tree_nodes = 0;
+	size_t graph_nodes = 0;
+	double cse_hit_rate = 0.0;
+
+	// Operations on constants alone which were evaluated, while recording
+	// and by the passes
+	size_t folded_constants = 0;
+
+	// Emitted statements, and those declaring a temporary
+	size_t statements = 0;
+	size_t temporaries = 0;
+
+	// Static cost estimate per invocation, from the cost of each operation
+	// and the width of its result
+	uint32_t alu_cost = 0;
+	uint32_t transcendental_cost = 0;
+};
+
+// Measuring a recording (given the folds while recording it) and its
+// compressed graph, and the graph as translated (given the pass statistics)
+void report_recording(const gir_tree &, const gcir_graph &, size_t, translation_report &);
+void report_translation(const gcir_graph &, const std::vector <pass_stats> &, translation_report &);
+
+// Push constants block of a pipeline with hoisted uniforms, along with the CPU
+// side program filling it from the original block before each draw
+struct uniform_program {
+	// List of the new members, as expressions over the original ones
+	gcir_graph graph;
+
+	// Offsets of the new members, and the size of the new block
+	std::vector <int> offsets;
+	size_t size = 0;
+
+	void operator()(const void *original, void *hoisted) const {
+		ceval_program(graph, offsets, original, hoisted);
+	}
+};
+
+// Moving every computation on push constants alone into new members; push
+// constants are a single range per pipeline, so all stages reading them are
+// rewritten together, into one block filled by one program
+void hoist_uniforms(const std::vector <gcir_graph *> &, uniform_program &);
+
+// Whether a node depends on push constants and literals alone
+bool uniform_node(const gcir_graph &, int);
+
+using pass_function = gcir_graph (*)(const gcir_graph &, const translation_options &);
+
+struct gcir_pass {
+	const char *name;
+	pass_function run;
+
+	// Lowest level the pass runs at
+	opt_level level;
+
+	// Optional switch on top of the level (e.g. fast math)
+	bool (*enabled)(const translation_options &) = nullptr;
+};
+
+struct pass_manager {
+	// Registered passes, in pipeline order
+	std::vector <gcir_pass> passes;
+
+	void add(const gcir_pass &pass) {
+		passes.push_back(pass);
+	}
+
+	gcir_graph run(gcir_graph, const translation_options &, std::vector <pass_stats> &) const;
+
+	// Pipeline used by translate <Stage>
+	static pass_manager &standard();
+};
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Vector which keeps its first N elements inline, only spilling into its
+// memory resource when it grows past that; restricted to trivially copyable
+// elements (handles and indices), which can be relocated with memcpy. Inside
+// a std::pmr container, it spills into the container's resource
+template <typename T, size_t N>
+struct small_vector {
+	static_assert(std::is_trivially_copyable_v <T>);
+
+	using value_type = T;
+	using allocator_type = std::pmr::polymorphic_allocator <std::byte>;
+	using iterator = T *;
+	using const_iterator = const T *;
+	using reverse_iterator = std::reverse_iterator <iterator>;
+	using const_reverse_iterator = std::reverse_iterator <const_iterator>;
+
+	// Spilled elements; null while the inline storage suffices
+	T *heap = nullptr;
+
+	uint32_t count = 0;
+	uint32_t capacity = N;
+
+	std::pmr::memory_resource *resource = std::pmr::get_default_resource();
+
+	alignas(T) std::byte storage[N * sizeof(T)];
+
+	small_vector() = default;
+
+	explicit small_vector(const allocator_type &allocator)
+			: resource(allocator.resource()) {}
+
+	small_vector(std::initializer_list <T> list) {
+		reserve(list.size());
+		std::memcpy((void *) data(), list.begin(), list.size() * sizeof(T));
+		count = list.size();
+	}
+
+	template <typename It>
+	small_vector(It first, It last) {
+		for (; first != last; first++)
+			push_back(*first);
+	}
+
+	explicit small_vector(size_t n, const T &value = T()) {
+		resize(n, value);
+	}
+
+	small_vector(const small_vector &other) {
+		*this = other;
+	}
+
+	small_vector(const small_vector &other, const allocator_type &allocator)
+			: resource(allocator.resource()) {
+		*this = other;
+	}
+
+	small_vector(small_vector &&other)
+			: resource(other.resource) {
+		*this = std::move(other);
+	}
+
+	small_vector(small_vector &&other, const allocator_type &allocator)
+			: resource(allocator.resource()) {
+		*this = std::move(other);
+	}
+
+	~small_vector() {
+		release();
+	}
+
+	allocator_type get_allocator() const {
+		return resource;
+	}
+
+	small_vector &operator=(const small_vector &other) {
+		if (this != &other) {
+			count = 0;
+			reserve(other.count);
+			std::memcpy((void *) data(), other.data(), other.count * sizeof(T));
+			count = other.count;
+		}
+
+		return *this;
+	}
+
+	small_vector &operator=(small_vector &&other) {
+		if (this == &other)
+			return *this;
+
+		if (other.heap && *other.resource == *resource) {
+			// Steal the spilled buffer
+			release();
+			heap = std::exchange(other.heap, nullptr);
+			count = std::exchange(other.count, 0);
+			capacity = std::exchange(other.capacity, N);
+		} else {
+			*this = (const small_vector &) other;
+			other.count = 0;
+		}
+
+		return *this;
+	}
+
+	// Element access
+	T *data() {
+		return heap ? heap : (T *) storage;
+	}
+
+	const T *data() const {
+		return heap ? heap : (const T *) storage;
+	}
+
+	T &operator[](size_t i) {
+		return data()[i];
+	}
+
+	const T &operator[](size_t i) const {
+		return data()[i];
+	}
+
+	T &back() {
+		return data()[count - 1];
+	}
+
+	const T &back() const {
+		return data()[count - 1];
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	bool empty() const {
+		return count == 0;
+	}
+
+	// Iterators
+	iterator begin() {
+		return data();
+	}
+
+	iterator end() {
+		return data() + count;
+	}
+
+	const_iterator begin() const {
+		return data();
+	}
+
+	const_iterator end() const {
+		return data() + count;
+	}
+
+	reverse_iterator rbegin() {
+		return reverse_iterator(end());
+	}
+
+	reverse_iterator rend() {
+		return reverse_iterator(begin());
+	}
+
+	const_reverse_iterator rbegin() const {
+		return const_reverse_iterator(end());
+	}
+
+	const_reverse_iterator rend() const {
+		return const_reverse_iterator(begin());
+	}
+
+	// Modifiers
+	void reserve(size_t n) {
+		if (n <= capacity)
+			return;
+
+		size_t grown = 2 * capacity;
+		n = n > grown ? n : grown;
+
+		T *spilled = (T *) resource->allocate(n * sizeof(T), alignof(T));
+		std::memcpy((void *) spilled, data(), count * sizeof(T));
+		release();
+
+		heap = spilled;
+		capacity = n;
+	}
+
+	// Returning the spilled buffer, if any, to the resource
+	void release() {
+		if (heap)
+			resource->deallocate(heap, capacity * sizeof(T), alignof(T));
+
+		heap = nullptr;
+	}
+
+	void push_back(const T &value) {
+		// Copy first, the value may live in this vector
+		T copy = value;
+		reserve(count + 1);
+		new (data() + count) T(copy);
+		count++;
+	}
+
+	void pop_back() {
+		count--;
+	}
+
+	void resize(size_t n, const T &value = T()) {
+		reserve(n);
+		for (size_t i = count; i < n; i++)
+			new (data() + i) T(value);
+		count = n;
+	}
+
+	iterator insert(const_iterator pos, const T &value) {
+		size_t index = pos - begin();
+		T copy = value;
+		reserve(count + 1);
+
+		T *at = data() + index;
+		std::memmove((void *) (at + 1), at, (count - index) * sizeof(T));
+		new (at) T(copy);
+		count++;
+		return at;
+	}
+
+	void clear() {
+		count = 0;
+	}
+
+	bool operator==(const small_vector &other) const {
+		if (count != other.count)
+			return false;
+
+		for (size_t i = 0; i < count; i++) {
+			if (!(data()[i] == other.data()[i]))
+				return false;
+		}
+
+		return true;
+	}
+};
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <array>
 #include <functional>
+#include <memory_resource>
 #include <optional>
+#include <set>
 #include <string>
 #include <type_traits>
 
@@ -9,6 +12,7 @@
 
 #include "gir.hpp"
 #include "core.hpp"
+#include "passes.hpp"
 
 // Translate into GLSL source code
 struct identifier {
@@ -16,6 +20,9 @@ struct identifier {
 	std::string prefix;
 	int id;
 
+	// Inlined operator expression, which needs parentheses as an operand
+	bool compound = false;
+
 	std::string full_id() const {
 		if (type == eNone)
 			return prefix;
@@ -23,12 +30,21 @@ struct identifier {
 		return prefix + std::to_string(id);
 	}
 
+	std::string operand() const {
+		return compound ? "(" + full_id() + ")" : full_id();
+	}
+
 	static identifier from(gloa type, int &generator) {
-		return { type, "_v", generator++ };
+		return { type, "_v", generator++, false };
 	}
 
 	static identifier builtin_from(const std::string &prefix) {
-		return { eNone, prefix };
+		return { eNone, prefix, 0, false };
+	}
+
+	// Expression standing in for a value, rather than a variable
+	static identifier inline_from(const std::string &expression, bool compound) {
+		return { eNone, expression, 0, compound };
 	}
 };
 
@@ -49,18 +65,34 @@ struct statement {
 	}
 };
 
-using statement_list = std::vector <statement>;
+using statement_list = std::pmr::vector <statement>;
 
-// Un-templated structures
-struct unt_layout_output {
-	gloa type;
-	int binding;
-	gir_tree gt;
+// Qualifiers of a stage's interface decided by linking; varyings which are
+// the same for the whole primitive need no interpolation
+struct shader_interface {
+	std::set <int> flat_inputs;
+	std::set <int> flat_outputs;
 };
 
 namespace detail {
 
-std::string translate(const gcir_graph &, const std::vector <unt_layout_output> &);
+std::string translate(const gcir_graph &, const shader_interface & = {},
+	const translation_options & = {}, translation_report * = nullptr);
+
+// Both stages reading the push constants block with one layout; the same
+// member at the same offset, and no two members over the same bytes
+void check_push_constants(const gcir_graph &, const gcir_graph &);
+
+// Moving fragment computations which interpolation commutes with into the
+// vertex shader, as new varyings
+void move_to_vertex(gcir_graph &, gcir_graph &);
+
+// Linking a vertex shader to the fragment shader it feeds; outputs which are
+// never read are dropped, along with what computes them
+gcir_graph link(const gcir_graph &, const gcir_graph &, shader_interface &, shader_interface &);
+
+// Packing the varyings of linked stages into as few locations as possible
+void pack_varyings(gcir_graph &, gcir_graph &, shader_interface &, shader_interface &);
 
 }
 
@@ -84,92 +116,244 @@ std::tuple <std::decay_t <Args>...> args_for_shader(void (&ftn)(Args...))
 	return std::tuple <std::decay_t <Args>...> {};
 }
 
-// Gather all output types
-struct shader_outputs {
-	std::optional <intrinsics::vertex> vintr;
-	std::vector <unt_layout_output> louts;
+// Compile-time facts about a single shader parameter; anything which is not a
+// layout or the vertex intrinsics is taken to be the push constants block
+template <typename T>
+struct shader_parameter {
+	static constexpr int input = -1;
+	static constexpr int output = -1;
+	static constexpr bool vertex_intrinsics = false;
+	static constexpr bool push_constants = std::is_class_v <T>;
 };
 
-template <typename T>
-struct gather_shader_single_output {
-	shader_outputs operator()(const T &) {
-		return {};
-	}
+template <typename T, int N>
+struct shader_parameter <layout_input <T, N>> {
+	static constexpr int input = N;
+	static constexpr int output = -1;
+	static constexpr bool vertex_intrinsics = false;
+	static constexpr bool push_constants = false;
+};
+
+template <typename T, int N>
+struct shader_parameter <layout_output <T, N>> {
+	static constexpr int input = -1;
+	static constexpr int output = N;
+	static constexpr bool vertex_intrinsics = false;
+	static constexpr bool push_constants = false;
 };
 
 template <>
-struct gather_shader_single_output <intrinsics::vertex> {
-	shader_outputs operator()(const intrinsics::vertex &vintr) {
-		return { .vintr = vintr };
-	}
+struct shader_parameter <intrinsics::vertex> {
+	static constexpr int input = -1;
+	static constexpr int output = -1;
+	static constexpr bool vertex_intrinsics = true;
+	static constexpr bool push_constants = false;
 };
 
-template <typename T, int N>
-struct gather_shader_single_output <layout_output <T, N>> {
-	shader_outputs operator()(const layout_output <T, N> &lout) {
-		unt_layout_output ulo { T::native_type, N, lout };
-		return { {}, { ulo } };
+// Bindings which are used (i.e. not -1) more than once
+template <size_t N>
+constexpr bool unique_bindings(const std::array <int, N> &bindings)
+{
+	for (size_t i = 0; i < N; i++) {
+		for (size_t j = i + 1; j < N; j++) {
+			if (bindings[i] >= 0 && bindings[i] == bindings[j])
+				return false;
+		}
 	}
+
+	return true;
+}
+
+// Signature of a shader, analyzed entirely at compile time
+template <typename ... Args>
+struct shader_signature {
+	static constexpr size_t outputs = ((shader_parameter <Args> ::output >= 0) + ... + 0);
+	static constexpr size_t vertex_intrinsics = (shader_parameter <Args> ::vertex_intrinsics + ... + 0);
+	static constexpr size_t push_constants = (shader_parameter <Args> ::push_constants + ... + 0);
+
+	static_assert(unique_bindings(std::array <int, sizeof...(Args)> { shader_parameter <Args> ::input... }),
+		"(cppsl) layout input bound more than once");
+
+	static_assert(unique_bindings(std::array <int, sizeof...(Args)> { shader_parameter <Args> ::output... }),
+		"(cppsl) layout output bound more than once");
+
+	static_assert(vertex_intrinsics <= 1, "(cppsl) only one instance of intrinsics::vertex is allowed per shader");
+	static_assert(push_constants <= 1, "(cppsl) only one push constants block is allowed per shader");
 };
 
-// TODO: pass shader stage to check vintr is false all the time
-template <typename T, typename ... Args>
-struct gather_shader_outputs {
-	gather_shader_outputs() = default;
-	gather_shader_outputs(void (&)(T, Args...)) {}
-	gather_shader_outputs(const std::function <void (T, Args...)> &) {}
-
-	shader_outputs operator()(const T &t, const Args &... args) {
-		gather_shader_single_output <std::decay_t <T>> singler;
-		shader_outputs vouts = singler(t);
-		shader_outputs later;
-		if constexpr (sizeof...(args)) {
-			auto later_gatherer = gather_shader_outputs <Args...> {};
-			later = later_gatherer(args...);
-		}
+template <typename F>
+struct shader_signature_of;
 
-		if (vouts.vintr) {
-			if (later.vintr)
-				fmt::system_error(1, "(cppsl) only one instance of intrinsics::vertex is allowed per vertex shader");
-		} else {
-			vouts.vintr = later.vintr;
-		}
+template <typename ... Args>
+struct shader_signature_of <void (Args...)> {
+	using type = shader_signature <std::decay_t <Args>...>;
+};
 
-		vouts.louts.insert(vouts.louts.begin(), later.louts.begin(), later.louts.end());
-		return vouts;
-	}
+template <typename ... Args>
+struct shader_signature_of <std::function <void (Args...)>> {
+	using type = shader_signature <std::decay_t <Args>...>;
 };
 
+// Output nodes of each parameter, each written into the next slot
+template <typename T>
+void shader_builtin_output(const T &, gir_tree *&) {}
+
+inline void shader_builtin_output(const intrinsics::vertex &vintr, gir_tree *&slot)
+{
+	const vec4 &gl_Position = vintr.gl_Position;
+	*slot++ = gir_tree::from(eGlPosition, { eVec4 }, gl_Position.cexpr(), { gl_Position });
+}
+
+template <typename T>
+void shader_layout_output(const T &, gir_tree *&) {}
+
+template <typename T, int N>
+void shader_layout_output(const layout_output <T, N> &lout, gir_tree *&slot)
+{
+	*slot++ = gir_tree::from(eLayoutOutput, { T::native_type, N }, lout.cexpr(), { lout });
+}
+
+// Generated source along with what the optimizer did to get there
+struct translation {
+	std::string source;
+	std::vector <pass_stats> stats;
+
+	// Only if requested in the options
+	std::optional <translation_report> report;
+};
+
+// Recording a shader, with all of its outputs unified into a single tree;
+// gl_Position first, if present
 template <Stage stage, typename F>
-std::string translate(const F &ftn)
+gir_tree record_shader(const F &ftn)
 {
+	using signature = typename shader_signature_of <F> ::type;
+
+	static_assert(stage == Stage::Vertex || !signature::vertex_intrinsics,
+		"(cppsl) intrinsics::vertex is only available to vertex shaders");
+
 	auto args = args_for_shader(ftn);
-	auto gatherer = gather_shader_outputs(ftn);
 	std::apply(ftn, args);
-	shader_outputs souts = std::apply(gatherer, args);
 
-	// Unify all outputs into a single tree
-	std::vector <gir_tree> outputs;
+	std::array <gir_tree, signature::outputs + signature::vertex_intrinsics> outputs;
+
+	gir_tree *slot = outputs.data();
+	std::apply([&](const auto &... args) {
+		(shader_builtin_output(args, slot), ...);
+		(shader_layout_output(args, slot), ...);
+	}, args);
 
 	bool cexpr = true;
+	for (const gir_tree &gt : outputs)
+		cexpr &= gt.cexpr();
+
+	return gir_tree::from(eNone, {}, cexpr, gir_children(outputs.begin(), outputs.end()));
+}
+
+template <Stage stage, typename F>
+translation translate_shader(const F &ftn, const translation_options &options = {})
+{
+	// The hoisted block replaces the original for the whole pipeline, so it
+	// must be laid out knowing every stage which reads it
+	if (options.hoist_uniforms)
+		throw fmt::system_error(1, "(cppsl) hoisting uniforms needs every stage, use translate_linked");
+
+	size_t folds = ceval_folds();
+	gir_tree unified = record_shader <stage> (ftn);
+	folds = ceval_folds() - folds;
+
+	// Everything allocated from here on dies with this call; nodes (and what
+	// was folded from them) in the interning arena, past the recording which
+	// the shader may still hold on to...
+	gir_scope scope;
+
+	// ...and the graphs, from a buffer on the stack
+	std::array <std::byte, 16384> buffer;
+	std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+
+	translation result;
+
+	gcir_graph graph = compress(unified, &arena);
+	if (options.report)
+		report_recording(unified, graph, folds, result.report.emplace());
+
+	graph = pass_manager::standard().run(std::move(graph), options, result.stats);
 
-	// TODO: check for presence of vintr
-	if (souts.vintr && stage == Stage::Vertex) {
-		vec4 gl_Position = souts.vintr->gl_Position;
-		cexpr &= gl_Position.cexpr;
-		outputs.push_back(gir_tree::from(eGlPosition, gl_Position.cexpr, { gl_Position }));
+	if (result.report)
+		report_translation(graph, result.stats, *result.report);
+
+	result.source = detail::translate(graph, {}, options, result.report ? &*result.report : nullptr);
+	return result;
+}
+
+// Both stages of a graphics pipeline, translated together
+struct linked_translation {
+	translation vertex;
+	translation fragment;
+
+	// Filling the push constants block both stages share, if uniforms were
+	// hoisted; its range must be visible to every stage reading it
+	uniform_program uniforms;
+};
+
+template <typename V, typename F>
+linked_translation translate_linked(const V &vertex, const F &fragment, const translation_options &options = {})
+{
+	// Folds while recording each stage
+	size_t folds = ceval_folds();
+	gir_tree vunified = record_shader <Stage::Vertex> (vertex);
+	size_t vfolds = ceval_folds() - folds;
+
+	folds = ceval_folds();
+	gir_tree funified = record_shader <Stage::Fragment> (fragment);
+	size_t ffolds = ceval_folds() - folds;
+
+	// Only the passes and translation, as above
+	gir_scope scope;
+
+	std::array <std::byte, 32768> buffer;
+	std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+
+	linked_translation result;
+
+	gcir_graph vgraph = compress(vunified, &arena);
+	gcir_graph fgraph = compress(funified, &arena);
+	if (options.report) {
+		report_recording(vunified, vgraph, vfolds, result.vertex.report.emplace());
+		report_recording(funified, fgraph, ffolds, result.fragment.report.emplace());
 	}
 
-	for (const unt_layout_output &lout : souts.louts) {
-		cexpr &= lout.gt.cexpr;
-		outputs.push_back(gir_tree::from(eLayoutOutput, lout.gt.cexpr, {
-			gir_tree::cfrom(lout.binding),
-			lout.gt
-		}));
+	vgraph = pass_manager::standard().run(std::move(vgraph), options, result.vertex.stats);
+	fgraph = pass_manager::standard().run(std::move(fgraph), options, result.fragment.stats);
+
+	detail::check_push_constants(vgraph, fgraph);
+	if (options.level != opt_level::O0)
+		detail::move_to_vertex(vgraph, fgraph);
+
+	shader_interface vinterface;
+	shader_interface finterface;
+	vgraph = detail::link(vgraph, fgraph, vinterface, finterface);
+
+	if (options.pack_varyings)
+		detail::pack_varyings(vgraph, fgraph, vinterface, finterface);
+
+	if (options.hoist_uniforms)
+		hoist_uniforms({ &vgraph, &fgraph }, result.uniforms);
+
+	if (options.report) {
+		report_translation(vgraph, result.vertex.stats, *result.vertex.report);
+		report_translation(fgraph, result.fragment.stats, *result.fragment.report);
 	}
 
-	gir_tree unified = gir_tree::from(eNone, cexpr, outputs);
-	gcir_graph graph = compress(unified);
+	result.vertex.source = detail::translate(vgraph, vinterface, options,
+		result.vertex.report ? &*result.vertex.report : nullptr);
+	result.fragment.source = detail::translate(fgraph, finterface, options,
+		result.fragment.report ? &*result.fragment.report : nullptr);
+	return result;
+}
 
-	return detail::translate(graph, souts.louts);
+template <Stage stage, typename F>
+std::string translate(const F &ftn, const translation_options &options = {})
+{
+	return translate_shader <stage> (ftn, options).source;
 }
@@ -1,104 +1,521 @@
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <optional>
+#include <vector>
 
 #include <fmt/printf.h>
 
 #include "fmt.hpp"
 #include "gir.hpp"
 
-gir_tree ceval_construct(const std::vector <gir_tree> &);
-gir_tree ceval_component(const std::vector <gir_tree> &);
+// Constant value of a node; scalars, vectors and (column-major) matrices
+struct cvalue {
+	gloa type = eNone;
+	uint32_t size = 0;
+	alignas(16) float v[16] {};
+};
 
-gir_tree ceval(const gir_tree &gt)
+// Four lanes, for the matrix kernels
+using f32x4 = float __attribute__((vector_size(16)));
+
+static int matrix_dimension(gloa type)
+{
+	switch (type) {
+	case eMat2:
+		return 2;
+	case eMat3:
+		return 3;
+	case eMat4:
+		return 4;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static cvalue cvalue_of(gloa type)
+{
+	cvalue out;
+	out.type = type;
+	out.size = gloa_info_of(type).components;
+	return out;
+}
+
+// Column c of an n x n matrix, zero padded to four lanes
+static f32x4 matrix_column(const cvalue &m, int n, int c)
+{
+	f32x4 col {};
+	for (int r = 0; r < n; r++)
+		col[r] = m.v[c * n + r];
+
+	return col;
+}
+
+// A (n x n) times B (n x k), one column of the result at a time
+static cvalue ceval_matrix_product(const cvalue &A, const cvalue &B, int n, int k, gloa type)
+{
+	f32x4 columns[4];
+	for (int c = 0; c < n; c++)
+		columns[c] = matrix_column(A, n, c);
+
+	cvalue out = cvalue_of(type);
+	for (int j = 0; j < k; j++) {
+		f32x4 sum {};
+		for (int c = 0; c < n; c++)
+			sum += columns[c] * B.v[j * n + c];
+
+		for (int r = 0; r < n; r++)
+			out.v[j * n + r] = sum[r];
+	}
+
+	return out;
+}
+
+// Row vector v (n) times M (n x n)
+static cvalue ceval_row_product(const cvalue &v, const cvalue &M, int n, gloa type)
+{
+	f32x4 row = matrix_column(v, n, 0);
+
+	cvalue out = cvalue_of(type);
+	for (int j = 0; j < n; j++) {
+		f32x4 p = row * matrix_column(M, n, j);
+		out.v[j] = p[0] + p[1] + p[2] + p[3];
+	}
+
+	return out;
+}
+
+// Elementwise operation, broadcasting scalar operands
+template <typename F>
+static cvalue ceval_componentwise(gloa type, const std::vector <cvalue> &args, F ftn)
+{
+	cvalue out = cvalue_of(type);
+
+	auto at = [](const cvalue &x, uint32_t i) {
+		return x.size == 1 ? x.v[0] : x.v[i];
+	};
+
+	for (uint32_t i = 0; i < out.size; i++) {
+		float a = at(args[0], i);
+		float b = args.size() > 1 ? at(args[1], i) : 0.0f;
+		float c = args.size() > 2 ? at(args[2], i) : 0.0f;
+		out.v[i] = ftn(a, b, c);
+	}
+
+	return out;
+}
+
+static float ceval_dot(const cvalue &x, const cvalue &y)
+{
+	float sum = 0.0f;
+	for (uint32_t i = 0; i < x.size; i++)
+		sum += x.v[i] * y.v[i];
+
+	return sum;
+}
+
+static cvalue ceval_scalar(float x)
+{
+	cvalue out = cvalue_of(eFloat32);
+	out.v[0] = x;
+	return out;
+}
+
+// Kernels for each kind of operation; nullopt if not foldable
+static std::optional <cvalue> ceval_construct(const gir_header &header, const std::vector <cvalue> &args)
 {
-	if (!gt.cexpr)
-		return gt;
-
-	if (std::holds_alternative <gloa> (gt.data)) {
-		gloa x = std::get <gloa> (gt.data);
-
-		// TODO: table/dispatcher
-		switch (x) {
-		case eConstruct:
-			return ceval_construct(gt.children);
-			break;
-		case eComponent:
-			return ceval_component(gt.children);
-			break;
-		default:
-			break;
+	cvalue out = cvalue_of(header.type);
+
+	int n = matrix_dimension(header.type);
+	if (args.size() == 1 && args[0].size == 1 && out.size > 1) {
+		// Broadcast for vectors, diagonal for matrices
+		for (uint32_t i = 0; i < out.size; i++)
+			out.v[i] = (n == 0 || i % (n + 1) == 0) ? args[0].v[0] : 0.0f;
+
+		return out;
+	}
+
+	if (args.size() == 1 && n && matrix_dimension(args[0].type)) {
+		// Resizing a matrix, e.g. mat3(mat4), padding with the identity
+		int m = matrix_dimension(args[0].type);
+		for (int c = 0; c < n; c++) {
+			for (int r = 0; r < n; r++)
+				out.v[c * n + r] = (c < m && r < m) ? args[0].v[c * m + r] : float(c == r);
 		}
+
+		return out;
+	}
+
+	// Concatenation of all components
+	uint32_t i = 0;
+	for (const cvalue &arg : args) {
+		for (uint32_t j = 0; j < arg.size && i < out.size; j++)
+			out.v[i++] = arg.v[j];
 	}
 
-	return gt;
+	if (i < out.size)
+		return std::nullopt;
+
+	return out;
 }
 
-// Constant expression evaluation of component access
-gir_tree ceval_construct(const std::vector <gir_tree> &nodes)
+static cvalue ceval_component(const gir_header &header, const cvalue &vector)
 {
-	gloa type = std::get <gloa> (nodes[0].data);
+	cvalue out = cvalue_of(header.type);
 
-	// TODO: branch on vector types
-	// for scalar types, simply do ceval(1)
-	if (type == eFloat32) {
-		return ceval(nodes[1]);
-	} else if (type == eVec4) {
-		int count = std::get <int> (nodes[1].data);
-		assert(nodes.size() == 6);
-		return gir_tree::cfrom(eConstruct, {
-			gir_tree::cfrom(eVec4),
-			gir_tree::cfrom(4),
-			ceval(nodes[2]),
-			ceval(nodes[3]),
-			ceval(nodes[4]),
-			ceval(nodes[5])
-		});
+	int mask = header.index;
+	for (int i = 0; i < swizzle_size(mask); i++)
+		out.v[i] = vector.v[swizzle_component(mask, i)];
+
+	return out;
+}
+
+static cvalue ceval_insert(const gir_header &header, const cvalue &vector, const cvalue &value)
+{
+	cvalue out = vector;
+
+	int mask = header.index;
+	for (int i = 0; i < swizzle_size(mask); i++)
+		out.v[swizzle_component(mask, i)] = value.v[i];
+
+	return out;
+}
+
+static std::optional <cvalue> ceval_binary(gloa x, const gir_header &header, const std::vector <cvalue> &args)
+{
+	const cvalue &A = args[0];
+	const cvalue &B = args[1];
+
+	switch (x) {
+	case eAdd:
+		return ceval_componentwise(header.type, args, [](float a, float b, float) { return a + b; });
+	case eSub:
+		return ceval_componentwise(header.type, args, [](float a, float b, float) { return a - b; });
+	case eDiv:
+		return ceval_componentwise(header.type, args, [](float a, float b, float) { return a / b; });
+	case eMul:
+		break;
+	default:
+		return std::nullopt;
 	}
 
-	assert(false);
+	// Linear algebra if a matrix is involved, elementwise otherwise
+	int na = matrix_dimension(A.type);
+	int nb = matrix_dimension(B.type);
+
+	if (na && B.size > 1)
+		return ceval_matrix_product(A, B, na, nb ? nb : 1, header.type);
+	if (nb && A.size > 1)
+		return ceval_row_product(A, B, nb, header.type);
+
+	return ceval_componentwise(header.type, args, [](float a, float b, float) { return a * b; });
+}
+
+static std::optional <cvalue> ceval_unary(gloa x, const gir_header &header, const std::vector <cvalue> &args)
+{
+	if (x == eNeg)
+		return ceval_componentwise(header.type, args, [](float a, float, float) { return -a; });
+
+	return std::nullopt;
 }
 
-using vector_variant = std::variant <std::vector <int>, std::vector <float>>;
+static std::optional <cvalue> ceval_intrinsic(gloa x, const gir_header &header, const std::vector <cvalue> &args)
+{
+	gloa type = header.type;
+
+	switch (x) {
+	case eAbs:
+		return ceval_componentwise(type, args, [](float a, float, float) { return std::abs(a); });
+	case eSign:
+		return ceval_componentwise(type, args, [](float a, float, float) { return float((a > 0) - (a < 0)); });
+	case eFloor:
+		return ceval_componentwise(type, args, [](float a, float, float) { return std::floor(a); });
+	case eCeil:
+		return ceval_componentwise(type, args, [](float a, float, float) { return std::ceil(a); });
+	case eFract:
+		return ceval_componentwise(type, args, [](float a, float, float) { return a - std::floor(a); });
+	case eSqrt:
+		return ceval_componentwise(type, args, [](float a, float, float) { return std::sqrt(a); });
+	case eInverseSqrt:
+		return ceval_componentwise(type, args, [](float a, float, float) { return 1.0f/std::sqrt(a); });
+	case eExp:
+		return ceval_componentwise(type, args, [](float a, float, float) { return std::exp(a); });
+	case eExp2:
+		return ceval_componentwise(type, args, [](float a, float, float) { return std::exp2(a); });
+	case eLog:
+		return ceval_componentwise(type, args, [](float a, float, float) { return std::log(a); });
+	case eLog2:
+		return ceval_componentwise(type, args, [](float a, float, float) { return std::log2(a); });
+	case eSin:
+		return ceval_componentwise(type, args, [](float a, float, float) { return std::sin(a); });
+	case eCos:
+		return ceval_componentwise(type, args, [](float a, float, float) { return std::cos(a); });
+	case eTan:
+		return ceval_componentwise(type, args, [](float a, float, float) { return std::tan(a); });
+	case eMin:
+		return ceval_componentwise(type, args, [](float a, float b, float) { return std::min(a, b); });
+	case eMax:
+		return ceval_componentwise(type, args, [](float a, float b, float) { return std::max(a, b); });
+	case eClamp:
+		return ceval_componentwise(type, args, [](float a, float lo, float hi) { return std::min(std::max(a, lo), hi); });
+	case eMix:
+		return ceval_componentwise(type, args, [](float a, float b, float t) { return a + (b - a) * t; });
+	case eStep:
+		return ceval_componentwise(type, args, [](float edge, float a, float) { return a < edge ? 0.0f : 1.0f; });
+	case eSmoothstep:
+		return ceval_componentwise(type, args, [](float e0, float e1, float a) {
+			float t = std::min(std::max((a - e0)/(e1 - e0), 0.0f), 1.0f);
+			return t * t * (3.0f - 2.0f * t);
+		});
+	case ePow:
+		return ceval_componentwise(type, args, [](float a, float b, float) { return std::pow(a, b); });
+	case eFma:
+		return ceval_componentwise(type, args, [](float a, float b, float c) { return std::fma(a, b, c); });
+	case eDot:
+		return ceval_scalar(ceval_dot(args[0], args[1]));
+	case eLength:
+		return ceval_scalar(std::sqrt(ceval_dot(args[0], args[0])));
+	case eDistance:
+	{
+		cvalue d = ceval_componentwise(args[0].type, args, [](float a, float b, float) { return a - b; });
+		return ceval_scalar(std::sqrt(ceval_dot(d, d)));
+	}
+	case eNormalize:
+	{
+		float length = std::sqrt(ceval_dot(args[0], args[0]));
+		return ceval_componentwise(type, args, [&](float a, float, float) { return a/length; });
+	}
+	case eCross:
+	{
+		const float *a = args[0].v;
+		const float *b = args[1].v;
+
+		cvalue out = cvalue_of(type);
+		out.v[0] = a[1] * b[2] - a[2] * b[1];
+		out.v[1] = a[2] * b[0] - a[0] * b[2];
+		out.v[2] = a[0] * b[1] - a[1] * b[0];
+		return out;
+	}
+	case eReflect:
+	{
+		// I - 2 dot(N, I) N
+		float d = ceval_dot(args[0], args[1]);
+		return ceval_componentwise(type, args, [&](float i, float n, float) { return i - 2.0f * d * n; });
+	}
+	default:
+		break;
+	}
 
-struct vector_variant_component_visitor {
-	int index;
+	return std::nullopt;
+}
 
-	template <typename T>
-	gir_tree operator()(const std::vector <T> &vv) {
-		return gir_tree::cfrom(vv.at(index));
+static std::optional <cvalue> ceval_apply(gloa x, const gir_header &header, const std::vector <cvalue> &args)
+{
+	switch (gloa_info_of(x).handler) {
+	case gloa_handler::eConstruct:
+		return ceval_construct(header, args);
+	case gloa_handler::eComponent:
+		return ceval_component(header, args[0]);
+	case gloa_handler::eInsert:
+		return ceval_insert(header, args[0], args[1]);
+	case gloa_handler::eBinary:
+		return ceval_binary(x, header, args);
+	case gloa_handler::eUnary:
+		return ceval_unary(x, header, args);
+	case gloa_handler::eIntrinsic:
+		return ceval_intrinsic(x, header, args);
+	default:
+		break;
 	}
+
+	return std::nullopt;
+}
+
+// Results per node, indexed like the arena; nodes never change once interned,
+// so every node is folded at most once per translation (see gir_scope)
+struct ceval_entry {
+	// Index of the folded node; -1 if not evaluated yet
+	int folded = -1;
+
+	std::optional <cvalue> value;
 };
 
-vector_variant ceval_vector_variant(const gir_tree &gt)
+static std::vector <ceval_entry> &ceval_cache()
+{
+	static thread_local std::vector <ceval_entry> cache;
+	return cache;
+}
+
+static size_t &ceval_counter()
+{
+	static thread_local size_t counter = 0;
+	return counter;
+}
+
+size_t ceval_folds()
+{
+	return ceval_counter();
+}
+
+void ceval_truncate(size_t count)
+{
+	auto &cache = ceval_cache();
+	if (cache.size() > count)
+		cache.resize(count);
+
+	// Older nodes may have been folded into newer ones
+	for (ceval_entry &entry : cache) {
+		if (entry.folded >= int(count))
+			entry = ceval_entry();
+	}
+}
+
+// Literal form of a constant; a bare scalar, or a construct of scalars
+static gir_tree ceval_literal(const cvalue &value)
 {
-	gir_tree cgt = ceval(gt);
+	if (value.size == 1)
+		return gir_tree::cfrom(value.v[0]);
 
-	assert(std::get <gloa> (cgt.data) == eConstruct);
+	gir_children components;
+	for (uint32_t i = 0; i < value.size; i++)
+		components.push_back(gir_tree::cfrom(value.v[i]));
 
-	auto nodes = cgt.children;
-	gloa type = std::get <gloa> (nodes[0].data);
+	return gir_tree::cfrom(eConstruct, { value.type }, std::move(components));
+}
+
+static const ceval_entry &ceval_node(const gir_tree &gt)
+{
+	auto &cache = ceval_cache();
+	if (size_t(gt.index) < cache.size() && cache[gt.index].folded >= 0)
+		return cache[gt.index];
+
+	ceval_entry entry;
 
-	if (type == eVec4) {
-		std::vector <float> vv(4);
-		for (size_t i = 0; i < 4; i++) {
-			gir_tree ci = ceval(nodes[i + 2]);
-			float cix = std::get <float> (ci.data);
-			vv[i] = cix;
+	const gir_t &data = gt.data();
+	if (data.holds <float> ()) {
+		entry.folded = gt.index;
+		entry.value = ceval_scalar(data.get <float> ());
+	} else if (!data.holds <gloa> ()) {
+		entry.folded = gt.index;
+	} else {
+		gloa x = data.get <gloa> ();
+		const gir_header &header = gt.header();
+
+		// Fold the children first, gathering their values
+		bool constant = true;
+		bool changed = false;
+
+		gir_children children;
+		std::vector <cvalue> args;
+		for (const gir_tree &c : gt.children()) {
+			const ceval_entry &ce = ceval_node(c);
+			children.push_back(gir_tree { ce.folded });
+			changed |= (ce.folded != c.index);
+			if (ce.value)
+				args.push_back(*ce.value);
+			else
+				constant = false;
 		}
 
-		return vv;
+		if (constant && !args.empty())
+			entry.value = ceval_apply(x, header, args);
+
+		if (entry.value)
+			ceval_counter()++;
+
+		if (entry.value)
+			entry.folded = ceval_literal(*entry.value).index;
+		else if (changed)
+			entry.folded = gir_tree::from(data, header, gt.cexpr(), std::move(children)).index;
+		else
+			entry.folded = gt.index;
 	}
 
-	assert(false);
+	// Interning may have grown the arena (and the cache with it) meanwhile
+	if (cache.size() <= size_t(gt.index))
+		cache.resize(gir_arena::active().nodes.size());
+
+	cache[gt.index] = entry;
+	return cache[gt.index];
+}
+
+// Folding every constant subtree into literals, in time linear in the number
+// of nodes not seen before
+gir_tree ceval(const gir_tree &gt)
+{
+	return gir_tree { ceval_node(gt).folded };
+}
+
+// Values in a std430 block; matrix columns are padded to the alignment of
+// the matrix (e.g. vec4 columns for mat3)
+static cvalue cvalue_load(gloa type, const std::byte *src)
+{
+	cvalue out = cvalue_of(type);
+
+	int n = matrix_dimension(type);
+	int columns = n ? n : 1;
+	int rows = n ? n : out.size;
+	int stride = n ? gloa_info_of(type).alignment : 0;
+
+	for (int c = 0; c < columns; c++)
+		std::memcpy(&out.v[c * rows], src + c * stride, rows * sizeof(float));
+
+	return out;
+}
+
+static void cvalue_store(const cvalue &value, std::byte *dst)
+{
+	int n = matrix_dimension(value.type);
+	int columns = n ? n : 1;
+	int rows = n ? n : value.size;
+	int stride = n ? gloa_info_of(value.type).alignment : 0;
+
+	for (int c = 0; c < columns; c++)
+		std::memcpy(dst + c * stride, &value.v[c * rows], rows * sizeof(float));
 }
 
-int ceval_int(const gir_tree &gt)
+static const cvalue &ceval_program_node(const gcir_graph &program, int T, const std::byte *in, std::vector <std::optional <cvalue>> &values)
 {
-	return std::get <int> (gt.data);
+	if (values[T])
+		return *values[T];
+
+	const gir_t &data = program.data[T];
+	const gir_header &header = program.headers[T];
+
+	if (data.holds <float> ()) {
+		values[T] = ceval_scalar(data.get <float> ());
+	} else if (data == ePushConstants) {
+		values[T] = cvalue_load(header.type, in + header.offset);
+	} else {
+		gloa x = data.get <gloa> ();
+
+		std::vector <cvalue> args;
+		for (int C : program.refs[T])
+			args.push_back(ceval_program_node(program, C, in, values));
+
+		values[T] = ceval_apply(x, header, args);
+		if (!values[T])
+			throw fmt::system_error(1, "(cppsl) cannot evaluate {} on the CPU", gloa_info_of(x).name);
+	}
+
+	return *values[T];
 }
 
-gir_tree ceval_component(const std::vector <gir_tree> &nodes)
+// Same kernels as folding, on values only; nothing is interned, so this is
+// fine to run for every draw
+void ceval_program(const gcir_graph &program, const std::vector <int> &offsets, const void *in, void *out)
 {
-	int index = ceval_int(nodes[0]);
-	vector_variant v = ceval_vector_variant(nodes[1]);
-	return std::visit(vector_variant_component_visitor { index }, v);
+	if (program.data.empty())
+		return;
+
+	std::vector <std::optional <cvalue>> values(program.data.size());
+
+	const auto &items = program.refs[0];
+	for (size_t i = 0; i < items.size(); i++) {
+		const cvalue &value = ceval_program_node(program, items[i], (const std::byte *) in, values);
+		cvalue_store(value, (std::byte *) out + offsets[i]);
+	}
 }
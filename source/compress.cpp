@@ -1,127 +1,130 @@
-#include <map>
-#include <iostream>
+#include <unordered_map>
 
 #include "gir.hpp"
 
-// Performing compressions on a GIR
-int fill_compressed_representation(const gir_tree &gt, gcir_graph &graph)
+using filled_map = std::pmr::unordered_map <int, int>;
+
+// Performing compressions on a GIR; shared (interned) nodes are only emitted once
+int fill_compressed_representation(const gir_tree &gt, gcir_graph &graph, filled_map &filled)
 {
+	if (auto it = filled.find(gt.index); it != filled.end())
+		return it->second;
+
 	int size = graph.data.size();
-	graph.data.push_back(gt.data);
+	graph.data.push_back(gt.data());
+	graph.headers.push_back(gt.header());
 	graph.refs.push_back({});
+	filled[gt.index] = size;
 
-	std::vector <int> refs;
-	for (const auto &cgt : gt.children)
-		refs.push_back(fill_compressed_representation(cgt, graph));
-	graph.refs[size] = refs;
+	gcir_refs refs(graph.resource());
+	for (const auto &cgt : gt.children())
+		refs.push_back(fill_compressed_representation(cgt, graph, filled));
+	graph.refs[size] = std::move(refs);
 	return size;
 }
 
-bool tree_cmp(const gcir_graph &gcir, int A, int B)
-{
-	if (gcir.data[A] != gcir.data[B])
-		return false;
-
-	if (gcir.refs[A].size() != gcir.refs[B].size())
-		return false;
-
-	for (size_t i = 0; i < gcir.refs[A].size(); i++) {
-		if (!tree_cmp(gcir, gcir.refs[A][i], gcir.refs[B][i]))
-			return false;
+// Value numbering; a node is identified by its atom, its header and its
+// children's numbers
+struct value_key {
+	gir_t data;
+	gir_header header;
+	gcir_refs refs;
+
+	bool operator==(const value_key &) const = default;
+};
+
+struct value_key_hash {
+	size_t operator()(const value_key &key) const {
+		size_t seed = std::hash <gir_t> {} (key.data) ^ std::hash <gir_header> {} (key.header);
+		for (int r : key.refs)
+			seed ^= std::hash <int> {} (r) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+		return seed;
 	}
+};
 
-	return true;
-}
+using value_table = std::pmr::unordered_map <value_key, int, value_key_hash>;
 
-int tree_size(const gcir_graph &gcir, int T)
+// Returns the representative node (the value number) of T
+int value_number(const gcir_graph &gcir, int T, std::pmr::vector <int> &numbers, value_table &table)
 {
-	int size = 1;
-	for (const auto &C : gcir.refs[T])
-		size += tree_size(gcir, C);
-	return size;
+	if (numbers[T] != -1)
+		return numbers[T];
+
+	value_key key { gcir.data[T], gcir.headers[T], gcir_refs(table.get_allocator().resource()) };
+	for (int C : gcir.refs[T])
+		key.refs.push_back(value_number(gcir, C, numbers, table));
+
+	auto [it, inserted] = table.emplace(std::move(key), T);
+	numbers[T] = it->second;
+	return numbers[T];
 }
 
-int readdress_compressed(const gcir_graph &gcir, int T, gcir_graph &graph, std::map <int, int> &filled)
+int readdress_compressed(const gcir_graph &gcir, int T, const std::pmr::vector <int> &numbers, gcir_graph &graph, std::pmr::vector <int> &filled)
 {
-	if (filled.count(T))
+	T = numbers[T];
+	if (filled[T] != -1)
 		return filled[T];
 
 	int size = graph.data.size();
 	graph.data.push_back(gcir.data[T]);
+	graph.headers.push_back(gcir.headers[T]);
 	graph.refs.push_back({});
 	filled[T] = size;
 
-	std::vector <int> refs;
+	gcir_refs refs(graph.resource());
 	for (int C : gcir.refs[T])
-		refs.push_back(readdress_compressed(gcir, C, graph, filled));
-	graph.refs[size] = refs;
+		refs.push_back(readdress_compressed(gcir, C, numbers, graph, filled));
+	graph.refs[size] = std::move(refs);
 	return size;
 }
 
-gcir_graph compress(const gir_tree &gt)
+// Merge all equivalent nodes in a single bottom-up pass, then drop unused ones
+gcir_graph deduplicate(const gcir_graph &gcir)
 {
-	gcir_graph graph;
-	fill_compressed_representation(gt, graph);
-
-	while (true) {
-		// printf("BEFORE: %lu nodes\n", graph.data.size());
-
-		std::vector <int> node_sizes;
-		for (size_t i = 0; i < graph.data.size(); i++)
-			node_sizes.push_back(tree_size(graph, i));
-
-		int max = 0;
-		int max_reffed = 0;
-
-		std::map <int, int> equals;
-		for (size_t i = 0; i < graph.data.size(); i++) {
-			if (equals.count(i))
-				continue;
-
-			for (size_t j = i + 1; j < graph.data.size(); j++) {
-				if (tree_cmp(graph, i, j)) {
-					equals[j] = i;
-
-					if (node_sizes[i] > max) {
-						max = node_sizes[i];
-						max_reffed = i;
-					}
-
-					// printf("equal branches: %lu, %lu\n", i, j);
-				}
-			}
-		}
-
-		if (equals.empty()) {
-			// printf("Out of compressions, done.\n");
-			break;
-		}
-
-		// printf("equal branch maps: CHOSEN %d\n", max_reffed);
-		// for (auto [j, i] : equals) {
-		// 	if (i != max_reffed)
-		// 		continue;
-		// 	printf("  %d -> %d\n", j, i);
-		// }
-
-		// Replace references
-		for (size_t i = 0; i < graph.data.size(); i++) {
-			for (int &r : graph.refs[i]) {
-				if (equals.count(r) && equals[r] == max_reffed)
-					r = max_reffed;
-			}
-		}
-
-		// Remove unused nodes by reconstructing the graph
-		gcir_graph regraph;
-		std::map <int, int> filled;
-		readdress_compressed(graph, 0, regraph, filled);
-		graph = regraph;
-
-		// printf("AFTER: %lu nodes\n", graph.data.size());
-
-		// TODO: repeat until no more replacements...
-	}
+	std::pmr::memory_resource *resource = gcir.resource();
 
+	std::pmr::vector <int> numbers(gcir.data.size(), -1, resource);
+	value_table table(resource);
+	value_number(gcir, 0, numbers, table);
+
+	gcir_graph graph(resource);
+	std::pmr::vector <int> filled(gcir.data.size(), -1, resource);
+	readdress_compressed(gcir, 0, numbers, graph, filled);
 	return graph;
 }
+
+gcir_graph compress(const gir_tree &gt, std::pmr::memory_resource *resource)
+{
+	gcir_graph graph(resource);
+	filled_map filled(resource);
+	fill_compressed_representation(gt, graph, filled);
+	return graph;
+}
+
+// Re-interning GCIR as GIR, so that tree passes (e.g. ceval) apply to graphs;
+// constness is recovered from the leaves, as only literals are constant
+gir_tree expand(const gcir_graph &gcir, int T, std::pmr::vector <int> &expanded)
+{
+	if (expanded[T] != -1)
+		return gir_tree { expanded[T] };
+
+	const gir_t &data = gcir.data[T];
+
+	bool cexpr = !data.holds <gloa> () || !gcir.refs[T].empty();
+
+	gir_children children;
+	for (int C : gcir.refs[T]) {
+		children.push_back(expand(gcir, C, expanded));
+		cexpr &= children.back().cexpr();
+	}
+
+	gir_tree gt = gir_tree::from(data, gcir.headers[T], cexpr, std::move(children));
+	expanded[T] = gt.index;
+	return gt;
+}
+
+gir_tree expand(const gcir_graph &gcir)
+{
+	std::pmr::vector <int> expanded(gcir.data.size(), -1, gcir.resource());
+	return expand(gcir, 0, expanded);
+}
@@ -0,0 +1,88 @@
+#include <unordered_map>
+#include <unordered_set>
+
+#include "gir.hpp"
+
+using rewritten_map = std::pmr::unordered_map <int, gir_tree>;
+using divisor_map = std::pmr::unordered_map <int, int>;
+
+// normalize(v) = v * inversesqrt(dot(v, v))
+gir_tree fast_normalize(const gir_header &header, bool cexpr, const gir_tree &v)
+{
+	gir_tree d = gir_tree::from(eDot, { eFloat32 }, cexpr, { v, v });
+	gir_tree rsq = gir_tree::from(eInverseSqrt, { eFloat32 }, cexpr, { d });
+	return gir_tree::from(eMul, header, cexpr, { v, rsq });
+}
+
+// Distinct divisions by each divisor
+void count_divisions(const gir_tree &gt, divisor_map &divisions, std::pmr::unordered_set <int> &visited)
+{
+	if (!visited.insert(gt.index).second)
+		return;
+
+	if (gt.data() == eDiv)
+		divisions[gt.children()[1].index]++;
+
+	for (const gir_tree &c : gt.children())
+		count_divisions(c, divisions, visited);
+}
+
+// a / b = a * (1 / b), so that divisions by the same value share one reciprocal
+gir_tree fast_division(const gir_header &header, bool cexpr, const gir_tree &a, const gir_tree &b)
+{
+	gir_tree rcp = gir_tree::from(eDiv, b.header(), b.cexpr(), { gir_tree::cfrom(1.0f), b });
+	return gir_tree::from(eMul, header, cexpr, { a, rcp });
+}
+
+// Only worth it when the reciprocal folds (a constant divisor), or when other
+// divisions share it; otherwise one division becomes a division and a multiply
+bool shared_reciprocal(const gir_tree &b, const divisor_map &divisions)
+{
+	if (b.cexpr())
+		return true;
+
+	auto it = divisions.find(b.index);
+	return it != divisions.end() && it->second > 1;
+}
+
+gir_tree fast_math(const gir_tree &gt, const divisor_map &divisions, rewritten_map &rewritten)
+{
+	if (auto it = rewritten.find(gt.index); it != rewritten.end())
+		return it->second;
+
+	bool changed = false;
+
+	gir_children children;
+	for (const gir_tree &c : gt.children()) {
+		children.push_back(fast_math(c, divisions, rewritten));
+		changed |= (children.back().index != c.index);
+	}
+
+	const gir_t &data = gt.data();
+	const gir_header &header = gt.header();
+
+	gir_tree result;
+	if (data == eNormalize) {
+		result = fast_normalize(header, gt.cexpr(), children[0]);
+	} else if (data == eDiv && !(children[0].data() == gir_t(1.0f))
+			&& shared_reciprocal(gt.children()[1], divisions)) {
+		result = fast_division(header, gt.cexpr(), children[0], children[1]);
+	} else if (changed) {
+		result = gir_tree::from(data, header, gt.cexpr(), std::move(children));
+	} else {
+		result = gt;
+	}
+
+	rewritten.emplace(gt.index, result);
+	return result;
+}
+
+gir_tree fast_math(const gir_tree &gt, std::pmr::memory_resource *resource)
+{
+	divisor_map divisions(resource);
+	std::pmr::unordered_set <int> visited(resource);
+	count_divisions(gt, divisions, visited);
+
+	rewritten_map rewritten(resource);
+	return fast_math(gt, divisions, rewritten);
+}
@@ -1,68 +1,180 @@
 #include "gir.hpp"
 
+uint32_t gir_strings::intern(const std::string &x)
+{
+	auto [it, inserted] = ids.emplace(x, names.size());
+	if (inserted)
+		names.push_back(x);
+
+	return it->second;
+}
+
+void gir_strings::truncate(size_t count)
+{
+	while (names.size() > count) {
+		ids.erase(names.back());
+		names.pop_back();
+	}
+}
+
+gir_strings &gir_strings::active()
+{
+	static thread_local gir_strings strings;
+	return strings;
+}
+
+// Structural comparison; children are interned, so comparing handles suffices
+bool gir_node::operator==(const gir_node &other) const
+{
+	if (data != other.data || header != other.header || cexpr != other.cexpr)
+		return false;
+
+	if (children.size() != other.children.size())
+		return false;
+
+	for (size_t i = 0; i < children.size(); i++) {
+		if (children[i].index != other.children[i].index)
+			return false;
+	}
+
+	return true;
+}
+
+static size_t hash_node(const gir_node &node)
+{
+	size_t seed = std::hash <gir_t> {} (node.data) ^ std::hash <gir_header> {} (node.header) ^ node.cexpr;
+	for (const gir_tree &child : node.children)
+		seed ^= std::hash <int> {} (child.index) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+	return seed;
+}
+
+int gir_arena::intern(gir_node &&node)
+{
+	size_t hash = hash_node(node);
+
+	auto [begin, end] = table.equal_range(hash);
+	for (auto it = begin; it != end; it++) {
+		if (nodes[it->second] == node)
+			return it->second;
+	}
+
+	int index = nodes.size();
+	nodes.push_back({
+		.data = node.data,
+		.header = node.header,
+		.cexpr = node.cexpr,
+		.children = gir_children(std::move(node.children), &spills)
+	});
+	table.emplace(hash, index);
+	return index;
+}
+
+void gir_arena::truncate(size_t count)
+{
+	while (nodes.size() > count) {
+		int index = nodes.size() - 1;
+
+		auto [begin, end] = table.equal_range(hash_node(nodes.back()));
+		for (auto it = begin; it != end; it++) {
+			if (it->second == index) {
+				table.erase(it);
+				break;
+			}
+		}
+
+		nodes.pop_back();
+	}
+}
+
+gir_arena &gir_arena::active()
+{
+	static thread_local gir_arena arena;
+	return arena;
+}
+
+gir_scope::gir_scope()
+		: nodes(gir_arena::active().nodes.size()),
+		names(gir_strings::active().names.size()) {}
+
+gir_scope::~gir_scope()
+{
+	ceval_truncate(nodes);
+	gir_arena::active().truncate(nodes);
+	gir_strings::active().truncate(names);
+}
+
+gir_header gir_header::of(const gir_t &data)
+{
+	if (data.holds <int> ())
+		return { eInt32 };
+	if (data.holds <float> ())
+		return { eFloat32 };
+
+	return {};
+}
+
 // Replace contents
-void gir_tree::rehash(gir_t data_, bool cexpr_, const std::vector <gir_tree> &children_)
+void gir_tree::rehash(gir_t data_, const gir_header &header_, bool cexpr_, const gir_children &children_)
+{
+	*this = from(data_, header_, cexpr_, children_);
+}
+
+void gir_tree::rehash(gir_t data_, const gir_header &header_, bool cexpr_, gir_children &&children_)
 {
-	data = data_;
-	cexpr = cexpr_;
-	children = children_;
+	*this = from(data_, header_, cexpr_, std::move(children_));
 }
 
-// Single element construction
+// Literals
 gir_tree gir_tree::from(gir_t data, bool cexpr)
 {
-	return {
-		.data = data,
-		.cexpr = cexpr,
-		.children = {}
-	};
+	return from(data, gir_header::of(data), cexpr);
 }
 
-// With children
-gir_tree gir_tree::from(gir_t data, bool cexpr, const std::vector <gir_tree> &children)
+gir_tree gir_tree::cfrom(gir_t data)
 {
-	return {
+	return from(data, true);
+}
+
+gir_tree gir_tree::vfrom(gir_t data)
+{
+	return from(data, false);
+}
+
+// Operations; children are moved into the arena if the node is new
+gir_tree gir_tree::from(gir_t data, const gir_header &header, bool cexpr, const gir_children &children)
+{
+	return from(data, header, cexpr, gir_children(children));
+}
+
+gir_tree gir_tree::from(gir_t data, const gir_header &header, bool cexpr, gir_children &&children)
+{
+	return { gir_arena::active().intern({
 		.data = data,
+		.header = header,
 		.cexpr = cexpr,
-		.children = children
-	};
+		.children = std::move(children)
+	}) };
 }
 
 // Constant alternatives
-gir_tree gir_tree::cfrom(gir_t data)
+gir_tree gir_tree::cfrom(gir_t data, const gir_header &header, const gir_children &children)
 {
-	return {
-		.data = data,
-		.cexpr = true,
-		.children = {}
-	};
+	return from(data, header, true, children);
 }
 
-gir_tree gir_tree::cfrom(gir_t data, const std::vector <gir_tree> &children)
+gir_tree gir_tree::cfrom(gir_t data, const gir_header &header, gir_children &&children)
 {
-	return {
-		.data = data,
-		.cexpr = true,
-		.children = children
-	};
+	return from(data, header, true, std::move(children));
 }
 
 // Variable alternatives
 // TODO: variadics?
-gir_tree gir_tree::vfrom(gir_t data)
+gir_tree gir_tree::vfrom(gir_t data, const gir_header &header, const gir_children &children)
 {
-	return {
-		.data = data,
-		.cexpr = false,
-		.children = {}
-	};
+	return from(data, header, false, children);
 }
 
-gir_tree gir_tree::vfrom(gir_t data, const std::vector <gir_tree> &children)
+gir_tree gir_tree::vfrom(gir_t data, const gir_header &header, gir_children &&children)
 {
-	return {
-		.data = data,
-		.cexpr = false,
-		.children = children
-	};
+	return from(data, header, false, std::move(children));
 }
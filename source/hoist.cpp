@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+#include "passes.hpp"
+
+// Operations the CPU program can evaluate
+static bool evaluable(gloa x)
+{
+	switch (gloa_info_of(x).handler) {
+	case gloa_handler::eConstruct:
+	case gloa_handler::eComponent:
+	case gloa_handler::eInsert:
+	case gloa_handler::eBinary:
+	case gloa_handler::eUnary:
+	case gloa_handler::eIntrinsic:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// What is known of each node of the shader
+struct uniform_info {
+	// Depends on push constants and literals only
+	bool uniform = false;
+
+	// Reads at least one push constant
+	bool reads = false;
+
+	// Involves some arithmetic, i.e. is worth hoisting
+	bool computes = false;
+};
+
+struct hoisting {
+	const gcir_graph &graph;
+
+	std::pmr::vector <uniform_info> info;
+	std::pmr::vector <bool> visited;
+
+	// Original push constants still needed, by member
+	std::pmr::map <int, int> kept;
+
+	// Computations to hoist, in order of discovery
+	std::pmr::vector <int> hoisted;
+
+	hoisting(const gcir_graph &graph)
+			: graph(graph),
+			info(graph.data.size(), graph.resource()),
+			visited(graph.data.size(), false, graph.resource()),
+			kept(graph.resource()),
+			hoisted(graph.resource()) {}
+
+	const uniform_info &analyze(int T) {
+		if (visited[T])
+			return info[T];
+
+		visited[T] = true;
+
+		const gir_t &data = graph.data[T];
+
+		uniform_info ui;
+		if (data.holds <float> ()) {
+			ui.uniform = true;
+		} else if (data == ePushConstants) {
+			ui.uniform = true;
+			ui.reads = true;
+		} else if (data.holds <gloa> () && !graph.refs[T].empty()) {
+			gloa x = data.get <gloa> ();
+
+			ui.uniform = evaluable(x);
+			ui.computes = (gloa_info_of(x).cost > 0);
+			for (int C : graph.refs[T]) {
+				const uniform_info &ci = analyze(C);
+				ui.uniform &= ci.uniform;
+				ui.reads |= ci.reads;
+				ui.computes |= ci.computes;
+			}
+		}
+
+		info[T] = ui;
+		return info[T];
+	}
+
+	// Uniform computations used by the rest of the shader are hoisted, and
+	// push constants read directly are kept
+	void select(int T, std::pmr::vector <bool> &seen) {
+		if (seen[T])
+			return;
+
+		seen[T] = true;
+
+		const uniform_info &ui = info[T];
+		if (graph.data[T] == ePushConstants) {
+			kept.emplace(graph.headers[T].index, T);
+			return;
+		}
+
+		if (ui.uniform && ui.reads && ui.computes) {
+			hoisted.push_back(T);
+			return;
+		}
+
+		for (int C : graph.refs[T])
+			select(C, seen);
+	}
+};
+
+bool uniform_node(const gcir_graph &graph, int T)
+{
+	hoisting state(graph);
+	return state.analyze(T).uniform;
+}
+
+// Stage with what its push constants were replaced by
+static gir_tree replace_uniforms(const gir_tree &gt, const std::unordered_map <int, gir_tree> &replaced,
+		std::unordered_map <int, gir_tree> &rewritten)
+{
+	if (auto it = replaced.find(gt.index); it != replaced.end())
+		return it->second;
+	if (auto it = rewritten.find(gt.index); it != rewritten.end())
+		return it->second;
+
+	bool changed = false;
+
+	gir_children children;
+	for (const gir_tree &c : gt.children()) {
+		children.push_back(replace_uniforms(c, replaced, rewritten));
+		changed |= (children.back().index != c.index);
+	}
+
+	gir_tree result = changed ? gir_tree::from(gt.data(), gt.header(), gt.cexpr(), std::move(children)) : gt;
+	rewritten.emplace(gt.index, result);
+	return result;
+}
+
+void hoist_uniforms(const std::vector <gcir_graph *> &stages, uniform_program &program)
+{
+	// Original members still read, by member, and computations to hoist;
+	// as interned trees, so that the stages share what they have in common
+	std::map <int, gir_tree> kept;
+	std::vector <gir_tree> hoisted;
+
+	for (gcir_graph *graph : stages) {
+		std::pmr::memory_resource *resource = graph->resource();
+
+		hoisting state(*graph);
+		state.analyze(0);
+
+		std::pmr::vector <bool> seen(graph->data.size(), false, resource);
+		state.select(0, seen);
+
+		std::pmr::vector <int> expanded(graph->data.size(), -1, resource);
+		for (const auto &[member, T] : state.kept)
+			kept.emplace(member, expand(*graph, T, expanded));
+
+		for (int T : state.hoisted) {
+			gir_tree gt = expand(*graph, T, expanded);
+			if (std::ranges::find(hoisted, gt.index, &gir_tree::index) == hoisted.end())
+				hoisted.push_back(gt);
+		}
+	}
+
+	// New block; the original members still read come first, in order,
+	// followed by the hoisted values
+	gir_children items;
+	for (const auto &[member, gt] : kept)
+		items.push_back(gt);
+	for (const gir_tree &gt : hoisted)
+		items.push_back(gt);
+
+	program = uniform_program();
+
+	std::unordered_map <int, gir_tree> replaced;
+
+	size_t offset = 0;
+	for (size_t i = 0; i < items.size(); i++) {
+		gloa type = items[i].header().type;
+		offset = gloa_align(offset, type);
+
+		replaced.emplace(items[i].index, gir_tree::vfrom(ePushConstants, { type, int(i), int(offset) }));
+		program.offsets.push_back(offset);
+
+		offset += gloa_info_of(type).size;
+	}
+
+	program.size = offset;
+	program.graph = compress(gir_tree::from(eNone, {}, false, std::move(items)));
+
+	// Stages reading the new block instead
+	std::unordered_map <int, gir_tree> rewritten;
+	for (gcir_graph *graph : stages)
+		*graph = compress(replace_uniforms(expand(*graph), replaced, rewritten), graph->resource());
+}
@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+#include "translate.hpp"
+
+// Fragment computations whose interpolated result is the same as their result
+// on interpolated inputs move to the vertex shader, as new varyings. That is
+// the case for values which are constant over a primitive (flat varyings,
+// shared push constants and literals), and for affine functions of smooth
+// varyings with such constants as coefficients; the interpolation weights sum
+// to one, so interpolation commutes with the function
+enum class variation {
+	eConstant,
+	eAffine,
+	eImmovable
+};
+
+// Interpolating one component of a varying, in ALU operations
+static constexpr int INTERPOLATION_COST = 1;
+
+// Fragments shaded per vertex shaded, assumed when weighing work moved into
+// the vertex shader against the fragment work it saves; conservative, dense
+// meshes come close to one
+static constexpr int FRAGMENTS_PER_VERTEX = 4;
+
+// Locations guaranteed by Vulkan (64 fragment input components)
+static constexpr int MAX_VARYING_LOCATIONS = 16;
+
+static bool varying_type(gloa type)
+{
+	return type == eFloat32 || type == eVec2 || type == eVec3 || type == eVec4;
+}
+
+static int location_count(gloa type)
+{
+	switch (type) {
+	case eMat3: return 3;
+	case eMat4: return 4;
+	default: return 1;
+	}
+}
+
+// What the vertex shader provides to the fragment shader
+struct vertex_varying {
+	gir_tree value;
+	bool uniform;
+};
+
+struct code_motion {
+	// Vertex outputs by binding, and push constants the vertex shader reads,
+	// by type and offset; the stages agree on the layout of the block (see
+	// check_push_constants), so equal offsets are the same member
+	std::map <int, vertex_varying> written;
+	std::map <std::pair <gloa, int>, gir_header> push_constants;
+
+	// Classification of fragment nodes, and whether they read a varying
+	std::unordered_map <int, variation> classes;
+	std::unordered_map <int, bool> reads;
+
+	variation classify(const gir_tree &gt) {
+		if (auto it = classes.find(gt.index); it != classes.end())
+			return it->second;
+
+		const gir_t &data = gt.data();
+		const gir_header &H = gt.header();
+
+		variation result = variation::eImmovable;
+		bool reading = false;
+
+		if (data.holds <float> ()) {
+			result = variation::eConstant;
+		} else if (data == eLayoutInput) {
+			auto it = written.find(H.index);
+			if (it != written.end() && it->second.value.header().type == H.type)
+				result = it->second.uniform ? variation::eConstant : variation::eAffine;
+
+			reading = true;
+		} else if (data == ePushConstants) {
+			if (push_constants.contains({ H.type, H.offset }))
+				result = variation::eConstant;
+		} else if (data.holds <gloa> () && !gt.children().empty()) {
+			gloa x = data.get <gloa> ();
+
+			int constants = 0;
+			int affines = 0;
+			for (const gir_tree &c : gt.children()) {
+				variation v = classify(c);
+				constants += (v == variation::eConstant);
+				affines += (v == variation::eAffine);
+				reading |= reads[c.index];
+			}
+
+			int n = gt.children().size();
+			if (constants + affines == n)
+				result = combine(x, gt, affines);
+		}
+
+		classes.emplace(gt.index, result);
+		reads.emplace(gt.index, reading);
+		return result;
+	}
+
+	// Operation on constant and affine operands, none of them immovable
+	variation combine(gloa x, const gir_tree &gt, int affines) {
+		gloa_handler handler = gloa_info_of(x).handler;
+		bool evaluable = (handler == gloa_handler::eConstruct || handler == gloa_handler::eComponent
+			|| handler == gloa_handler::eInsert || handler == gloa_handler::eBinary
+			|| handler == gloa_handler::eUnary || handler == gloa_handler::eIntrinsic);
+
+		if (!evaluable)
+			return variation::eImmovable;
+		if (affines == 0)
+			return variation::eConstant;
+
+		auto constant = [&](int i) { return classes[gt.children()[i].index] == variation::eConstant; };
+
+		switch (x) {
+		case eConstruct: case eComponent: case eInsert:
+		case eAdd: case eSub: case eNeg:
+			return variation::eAffine;
+
+		// Bilinear; affine when either side is constant
+		case eMul: case eDot: case eCross:
+			return affines == 1 ? variation::eAffine : variation::eImmovable;
+
+		case eDiv:
+			return constant(1) ? variation::eAffine : variation::eImmovable;
+
+		case eFma:
+			return (constant(0) || constant(1)) ? variation::eAffine : variation::eImmovable;
+
+		case eMix:
+			return constant(2) ? variation::eAffine : variation::eImmovable;
+
+		default:
+			return variation::eImmovable;
+		}
+	}
+
+	bool movable(const gir_tree &gt) {
+		return classify(gt) != variation::eImmovable && reads[gt.index];
+	}
+
+	// Largest movable subgraphs used by the rest of the fragment shader
+	void candidates(const gir_tree &gt, std::vector <gir_tree> &out, std::set <int> &visited) {
+		if (!visited.insert(gt.index).second)
+			return;
+
+		if (movable(gt) && varying_type(gt.header().type)) {
+			if (!(gt.data() == eLayoutInput))
+				out.push_back(gt);
+
+			return;
+		}
+
+		for (const gir_tree &c : gt.children())
+			candidates(c, out, visited);
+	}
+
+	// Fragment shader reading the given nodes as varyings instead
+	static gir_tree replace(const gir_tree &gt, const std::map <int, gir_tree> &moved,
+			std::unordered_map <int, gir_tree> &rewritten) {
+		if (auto it = moved.find(gt.index); it != moved.end())
+			return it->second;
+		if (auto it = rewritten.find(gt.index); it != rewritten.end())
+			return it->second;
+
+		bool changed = false;
+
+		gir_children children;
+		for (const gir_tree &c : gt.children()) {
+			children.push_back(replace(c, moved, rewritten));
+			changed |= (children.back().index != c.index);
+		}
+
+		gir_tree result = changed ? gir_tree::from(gt.data(), gt.header(), gt.cexpr(), std::move(children)) : gt;
+		rewritten.emplace(gt.index, result);
+		return result;
+	}
+
+	// Cost of a fragment shader; operations, and interpolated components
+	struct fragment_cost {
+		int operations = 0;
+		int components = 0;
+	};
+
+	static void measure(const gir_tree &gt, fragment_cost &cost, std::set <int> &visited) {
+		if (!visited.insert(gt.index).second)
+			return;
+
+		const gir_t &data = gt.data();
+		if (data == eLayoutInput) {
+			cost.components += gloa_info_of(gt.header().type).components;
+		} else if (data.holds <gloa> ()) {
+			cost.operations += gloa_info_of(data.get <gloa> ()).cost;
+		}
+
+		for (const gir_tree &c : gt.children())
+			measure(c, cost, visited);
+	}
+
+	static fragment_cost measure(const gir_tree &gt) {
+		fragment_cost cost;
+		std::set <int> visited;
+		measure(gt, cost, visited);
+		return cost;
+	}
+
+	// The same computation in the vertex shader, on what it writes
+	gir_tree to_vertex(const gir_tree &gt, std::unordered_map <int, gir_tree> &copied) {
+		if (auto it = copied.find(gt.index); it != copied.end())
+			return it->second;
+
+		const gir_t &data = gt.data();
+		const gir_header &H = gt.header();
+
+		gir_tree result = gt;
+		if (data == eLayoutInput) {
+			result = written.at(H.index).value;
+		} else if (data == ePushConstants) {
+			result = gir_tree::vfrom(ePushConstants, push_constants.at({ H.type, H.offset }));
+		} else if (!gt.children().empty()) {
+			bool cexpr = true;
+
+			gir_children children;
+			for (const gir_tree &c : gt.children()) {
+				children.push_back(to_vertex(c, copied));
+				cexpr &= children.back().cexpr();
+			}
+
+			result = gir_tree::from(data, H, cexpr, std::move(children));
+		}
+
+		copied.emplace(gt.index, result);
+		return result;
+	}
+};
+
+namespace detail {
+
+void move_to_vertex(gcir_graph &vertex, gcir_graph &fragment)
+{
+	code_motion state;
+
+	gir_tree vroot = expand(vertex);
+
+	const gcir_refs &vrefs = vertex.refs[0];
+	for (size_t i = 0; i < vrefs.size(); i++) {
+		int T = vrefs[i];
+		if (!(vertex.data[T] == eLayoutOutput))
+			continue;
+
+		gir_tree value = vroot.children()[i].children()[0];
+		state.written.emplace(vertex.headers[T].index, vertex_varying { value, uniform_node(vertex, vertex.refs[T][0]) });
+	}
+
+	for (size_t T = 0; T < vertex.data.size(); T++) {
+		const gir_header &H = vertex.headers[T];
+		if (vertex.data[T] == ePushConstants)
+			state.push_constants.emplace(std::make_pair(H.type, H.offset), H);
+	}
+
+	gir_tree froot = expand(fragment);
+
+	std::vector <gir_tree> candidates;
+	std::set <int> visited;
+	state.candidates(froot, candidates, visited);
+
+	// New varyings take locations after every existing one
+	int location = 0;
+	for (const auto &[binding, varying] : state.written)
+		location = std::max(location, binding + location_count(varying.value.header().type));
+
+	// Each candidate moves if the work it saves every fragment outweighs the
+	// interpolation of the varyings it adds (less those no longer read), and
+	// the work it adds to every vertex; the latter is the whole moved
+	// subgraph, less what earlier candidates already moved, even if parts of
+	// it stay in the fragment shader for other uses
+	std::map <int, gir_tree> moved;
+	std::unordered_map <int, gir_tree> rewritten;
+
+	std::set <int> in_vertex;
+
+	code_motion::fragment_cost current = code_motion::measure(froot);
+	for (const gir_tree &candidate : candidates) {
+		gloa type = candidate.header().type;
+		if (location + location_count(type) > MAX_VARYING_LOCATIONS)
+			continue;
+
+		gir_tree input = gir_tree::vfrom(eLayoutInput, { type, location });
+
+		std::map <int, gir_tree> attempt = moved;
+		attempt.emplace(candidate.index, input);
+
+		std::unordered_map <int, gir_tree> scratch;
+		code_motion::fragment_cost next = code_motion::measure(code_motion::replace(froot, attempt, scratch));
+
+		std::set <int> vertex_attempt = in_vertex;
+		code_motion::fragment_cost vertex_cost;
+		code_motion::measure(candidate, vertex_cost, vertex_attempt);
+
+		int saved = current.operations - next.operations;
+		int added = INTERPOLATION_COST * (next.components - current.components);
+		if (FRAGMENTS_PER_VERTEX * (saved - added) <= vertex_cost.operations)
+			continue;
+
+		in_vertex = std::move(vertex_attempt);
+		moved = std::move(attempt);
+		current = next;
+		location += location_count(type);
+	}
+
+	if (moved.empty())
+		return;
+
+	// Vertex shader writing the new varyings, after its own outputs
+	gir_children outputs(vroot.children().begin(), vroot.children().end());
+
+	std::unordered_map <int, gir_tree> copied;
+	for (const gir_tree &candidate : candidates) {
+		auto it = moved.find(candidate.index);
+		if (it == moved.end())
+			continue;
+
+		gir_tree value = state.to_vertex(candidate, copied);
+		outputs.push_back(gir_tree::from(eLayoutOutput, it->second.header(), value.cexpr(), { value }));
+	}
+
+	bool cexpr = true;
+	for (const gir_tree &gt : outputs)
+		cexpr &= gt.cexpr();
+
+	vertex = compress(gir_tree::from(eNone, {}, cexpr, std::move(outputs)), vertex.resource());
+	fragment = compress(code_motion::replace(froot, moved, rewritten), fragment.resource());
+}
+
+}
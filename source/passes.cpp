@@ -0,0 +1,110 @@
+#include <chrono>
+
+#include "passes.hpp"
+
+// Bound on fixed-point iteration, in case passes keep undoing each other
+static constexpr int MAX_ROUNDS = 8;
+
+static bool same_graph(const gcir_graph &A, const gcir_graph &B)
+{
+	return A.data == B.data && A.headers == B.headers && A.refs == B.refs;
+}
+
+gcir_graph pass_manager::run(gcir_graph graph, const translation_options &options, std::vector <pass_stats> &stats) const
+{
+	if (options.level == opt_level::O0)
+		return graph;
+
+	// Passes selected for this translation, with their statistics
+	std::vector <const gcir_pass *> selected;
+	for (const gcir_pass &pass : passes) {
+		if (options.level < pass.level)
+			continue;
+		if (pass.enabled && !pass.enabled(options))
+			continue;
+
+		selected.push_back(&pass);
+		stats.push_back({ .name = pass.name });
+	}
+
+	size_t offset = stats.size() - selected.size();
+
+	int rounds = options.level == opt_level::O2 ? MAX_ROUNDS : 1;
+	for (int r = 0; r < rounds; r++) {
+		bool changed = false;
+		for (size_t i = 0; i < selected.size(); i++) {
+			size_t folds = ceval_folds();
+			auto start = std::chrono::steady_clock::now();
+			gcir_graph next = selected[i]->run(graph, options);
+			auto end = std::chrono::steady_clock::now();
+
+			pass_stats &ps = stats[offset + i];
+			if (ps.runs == 0)
+				ps.nodes_before = graph.data.size();
+
+			ps.nodes_after = next.data.size();
+			ps.delta += long(next.data.size()) - long(graph.data.size());
+			ps.folded += ceval_folds() - folds;
+			ps.milliseconds += std::chrono::duration <double, std::milli> (end - start).count();
+			ps.runs++;
+
+			changed |= !same_graph(graph, next);
+			graph = std::move(next);
+		}
+
+		if (!changed)
+			break;
+	}
+
+	return graph;
+}
+
+// Standard passes
+static gcir_graph fold_pass(const gcir_graph &graph, const translation_options &)
+{
+	return compress(ceval(expand(graph)), graph.resource());
+}
+
+static gcir_graph fast_math_pass(const gcir_graph &graph, const translation_options &)
+{
+	return compress(fast_math(expand(graph), graph.resource()), graph.resource());
+}
+
+static gcir_graph reassociate_pass(const gcir_graph &graph, const translation_options &options)
+{
+	return compress(reassociate(expand(graph), graph.resource(), options.hoist_uniforms), graph.resource());
+}
+
+static gcir_graph peephole_pass(const gcir_graph &graph, const translation_options &options)
+{
+	return compress(peephole(expand(graph), graph.resource(), options.fast_math), graph.resource());
+}
+
+static gcir_graph vectorize_pass(const gcir_graph &graph, const translation_options &)
+{
+	return compress(vectorize(expand(graph), graph.resource()), graph.resource());
+}
+
+static gcir_graph cse_pass(const gcir_graph &graph, const translation_options &)
+{
+	return deduplicate(graph);
+}
+
+pass_manager &pass_manager::standard()
+{
+	static pass_manager manager = [] {
+		pass_manager pm;
+
+		pm.add({ "fast-math", fast_math_pass, opt_level::O1,
+			[](const translation_options &options) { return options.fast_math; } });
+		pm.add({ "reassociate", reassociate_pass, opt_level::O1 });
+		pm.add({ "fold", fold_pass, opt_level::O1 });
+		pm.add({ "peephole", peephole_pass, opt_level::O1 });
+		pm.add({ "vectorize", vectorize_pass, opt_level::O1 });
+		pm.add({ "cse", cse_pass, opt_level::O1 });
+
+		return pm;
+	} ();
+
+	return manager;
+}
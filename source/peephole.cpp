@@ -0,0 +1,237 @@
+#include <cmath>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "gir.hpp"
+
+// Local rewrites of arithmetic; identities, negation, FMA contraction and
+// exact reciprocals. The rules keep NaN and infinity as they are, except for
+// x * 0 = 0 (NaN for infinite x), which is left to fast math unless x is a
+// finite literal
+static bool is_vector(gloa type)
+{
+	return type == eVec2 || type == eVec3 || type == eVec4;
+}
+
+// Value of a scalar literal, or of a vector with all components equal
+static std::optional <float> splat_value(const gir_tree &gt)
+{
+	const gir_t &data = gt.data();
+	if (data.holds <float> ())
+		return data.get <float> ();
+
+	if (!(data == eConstruct) || !is_vector(gt.header().type))
+		return std::nullopt;
+
+	std::optional <float> value;
+	for (const gir_tree &c : gt.children()) {
+		if (!c.data().holds <float> ())
+			return std::nullopt;
+
+		float x = c.data().get <float> ();
+		if (value && *value != x)
+			return std::nullopt;
+
+		value = x;
+	}
+
+	return value;
+}
+
+static bool is_literal(const gir_tree &gt, float x)
+{
+	auto value = splat_value(gt);
+	return value && *value == x;
+}
+
+// Literal of the given type with all components set to x
+static gir_tree splat(gloa type, float x)
+{
+	if (type == eFloat32)
+		return gir_tree::cfrom(x);
+
+	return gir_tree::cfrom(eConstruct, { type }, { gir_tree::cfrom(x) });
+}
+
+// Reciprocal of c, if it is exact (powers of two)
+static std::optional <float> exact_reciprocal(float c)
+{
+	int exponent;
+	if (c == 0.0f || !std::isfinite(c) || std::abs(std::frexp(c, &exponent)) != 0.5f)
+		return std::nullopt;
+
+	return 1.0f/c;
+}
+
+struct peephole_state {
+	// Number of references to each node
+	std::pmr::unordered_map <int, int> uses;
+
+	std::pmr::unordered_map <int, gir_tree> rewritten;
+
+	// Whether values may change for non-finite operands
+	bool fast_math;
+
+	peephole_state(std::pmr::memory_resource *resource, bool fast_math)
+			: uses(resource), rewritten(resource), fast_math(fast_math) {}
+
+	void count(const gir_tree &gt, std::unordered_set <int> &visited) {
+		if (!visited.insert(gt.index).second)
+			return;
+
+		for (const gir_tree &c : gt.children()) {
+			uses[c.index]++;
+			count(c, visited);
+		}
+	}
+
+	static gir_tree negate(const gir_tree &x) {
+		if (x.data() == eNeg)
+			return x.children()[0];
+
+		return gir_tree::from(eNeg, { x.header().type }, x.cexpr(), { x });
+	}
+
+	// a * b + c as fma(a, b, c); only if the product is not needed elsewhere
+	// and all operands have the (scalar or vector) result type
+	std::optional <gir_tree> contract(const gir_header &header, const gir_tree &original,
+			const gir_tree &product, const gir_tree &addend) {
+		if (!(product.data() == eMul) || uses[original.index] != 1)
+			return std::nullopt;
+
+		gloa type = header.type;
+		if (type != eFloat32 && !is_vector(type))
+			return std::nullopt;
+
+		const gir_tree &a = product.children()[0];
+		const gir_tree &b = product.children()[1];
+		if (a.header().type != type || b.header().type != type || addend.header().type != type)
+			return std::nullopt;
+
+		bool cexpr = a.cexpr() & b.cexpr() & addend.cexpr();
+		return gir_tree::from(eFma, header, cexpr, { a, b, addend });
+	}
+
+	// Whether x * 0 is 0
+	bool annihilable(const gir_tree &x) const {
+		if (fast_math)
+			return true;
+
+		auto value = splat_value(x);
+		return value && std::isfinite(*value);
+	}
+
+	std::optional <gir_tree> simplify(const gir_tree &gt, const gir_children &children) {
+		const gir_header &header = gt.header();
+		gloa type = header.type;
+
+		const gir_t &data = gt.data();
+		if (data == eNeg) {
+			// -(-x) = x
+			if (children[0].data() == eNeg)
+				return children[0].children()[0];
+
+			return std::nullopt;
+		}
+
+		if (children.size() != 2)
+			return std::nullopt;
+
+		const gir_tree &A = children[0];
+		const gir_tree &B = children[1];
+
+		// Operands which can stand for the whole expression
+		bool a_whole = (A.header().type == type);
+		bool b_whole = (B.header().type == type);
+
+		if (data == eMul) {
+			if (is_literal(B, 1.0f) && a_whole)
+				return A;
+			if (is_literal(A, 1.0f) && b_whole)
+				return B;
+			if (is_literal(B, -1.0f) && a_whole)
+				return negate(A);
+			if (is_literal(A, -1.0f) && b_whole)
+				return negate(B);
+			if ((is_literal(A, 0.0f) && annihilable(B)) || (is_literal(B, 0.0f) && annihilable(A)))
+				return splat(type, 0.0f);
+
+			// (-a) * (-b) = a * b
+			if (A.data() == eNeg && B.data() == eNeg)
+				return gir_tree::from(eMul, header, gt.cexpr(), { A.children()[0], B.children()[0] });
+		} else if (data == eAdd) {
+			if (is_literal(B, 0.0f) && a_whole)
+				return A;
+			if (is_literal(A, 0.0f) && b_whole)
+				return B;
+
+			if (auto fma = contract(header, gt.children()[0], A, B))
+				return fma;
+			if (auto fma = contract(header, gt.children()[1], B, A))
+				return fma;
+
+			// a + (-b) = a - b
+			if (B.data() == eNeg && a_whole && b_whole)
+				return gir_tree::from(eSub, header, gt.cexpr(), { A, B.children()[0] });
+			if (A.data() == eNeg && a_whole && b_whole)
+				return gir_tree::from(eSub, header, gt.cexpr(), { B, A.children()[0] });
+		} else if (data == eSub) {
+			if (is_literal(B, 0.0f) && a_whole)
+				return A;
+			if (is_literal(A, 0.0f) && b_whole)
+				return negate(B);
+
+			// a - (-b) = a + b
+			if (B.data() == eNeg && a_whole && b_whole)
+				return gir_tree::from(eAdd, header, gt.cexpr(), { A, B.children()[0] });
+		} else if (data == eDiv) {
+			if (is_literal(B, 1.0f) && a_whole)
+				return A;
+
+			// Divisions by a power of two are exact multiplications; other
+			// constants are left to fast math
+			auto c = splat_value(B);
+			if (c && B.header().type == eFloat32) {
+				if (auto rcp = exact_reciprocal(*c))
+					return gir_tree::from(eMul, header, gt.cexpr(), { A, gir_tree::cfrom(*rcp) });
+			}
+		}
+
+		return std::nullopt;
+	}
+
+	gir_tree rewrite(const gir_tree &gt) {
+		if (auto it = rewritten.find(gt.index); it != rewritten.end())
+			return it->second;
+
+		bool changed = false;
+
+		gir_children children;
+		for (const gir_tree &c : gt.children()) {
+			children.push_back(rewrite(c));
+			changed |= (children.back().index != c.index);
+		}
+
+		gir_tree result = gt;
+		if (gt.data().holds <gloa> ()) {
+			if (auto simplified = simplify(gt, children))
+				result = *simplified;
+			else if (changed)
+				result = gir_tree::from(gt.data(), gt.header(), gt.cexpr(), std::move(children));
+		}
+
+		rewritten.emplace(gt.index, result);
+		return result;
+	}
+};
+
+gir_tree peephole(const gir_tree &gt, std::pmr::memory_resource *resource, bool fast_math)
+{
+	peephole_state state(resource, fast_math);
+
+	std::unordered_set <int> visited;
+	state.count(gt, visited);
+
+	return state.rewrite(gt);
+}
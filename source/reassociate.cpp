@@ -0,0 +1,251 @@
+#include <climits>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "gir.hpp"
+
+// Matrix (and matrix-vector) products are associative, so a chain like
+// P * V * M * v can be evaluated in any order; the recorded (left to right)
+// order is often the most expensive one
+static int dimension(gloa type)
+{
+	switch (type) {
+	case eVec2: case eMat2: return 2;
+	case eVec3: case eMat3: return 3;
+	case eVec4: case eMat4: return 4;
+	default: return 0;
+	}
+}
+
+static bool is_matrix(gloa type)
+{
+	return type == eMat2 || type == eMat3 || type == eMat4;
+}
+
+static bool is_vector(gloa type)
+{
+	return type == eVec2 || type == eVec3 || type == eVec4;
+}
+
+// Products which can take part in a chain; matrix by matrix, or matrix by
+// (column) vector as the last factor
+static bool chain_product(const gir_tree &gt)
+{
+	if (!(gt.data() == eMul))
+		return false;
+
+	gloa rtype = gt.header().type;
+	gloa A = gt.children()[0].header().type;
+	gloa B = gt.children()[1].header().type;
+	if (!is_matrix(A) || dimension(A) != dimension(rtype) || dimension(B) != dimension(A))
+		return false;
+
+	return (is_matrix(rtype) && is_matrix(B)) || (is_vector(rtype) && is_vector(B));
+}
+
+using factor_list = std::pmr::vector <int>;
+
+// Products computed on the CPU (hoisted uniforms) weigh next to nothing
+// compared to products computed for every invocation
+static constexpr int INVOCATION_WEIGHT = 1 << 12;
+
+struct reassociation {
+	// Number of references to each node
+	std::pmr::unordered_map <int, int> uses;
+
+	// Factors of each chain, keyed by the chain's (original) root
+	std::pmr::unordered_map <int, factor_list> chains;
+
+	// Chains by their factors; any product in this map is computed anyway,
+	// so reusing it within another chain is free
+	std::pmr::map <factor_list, int> products;
+
+	std::pmr::unordered_map <int, gir_tree> rewritten;
+
+	// Whether products of push constants will be hoisted, and which nodes
+	// depend on push constants and literals only
+	bool hoisting;
+	std::pmr::unordered_map <int, bool> uniform;
+
+	reassociation(std::pmr::memory_resource *resource, bool hoisting)
+			: uses(resource), chains(resource), products(resource), rewritten(resource),
+			hoisting(hoisting), uniform(resource) {}
+
+	bool is_uniform(const gir_tree &gt) {
+		if (auto it = uniform.find(gt.index); it != uniform.end())
+			return it->second;
+
+		const gir_t &data = gt.data();
+
+		bool result = data.holds <float> () || data == ePushConstants;
+		if (!result && data.holds <gloa> () && !gt.children().empty()) {
+			gloa_handler handler = gloa_info_of(data.get <gloa> ()).handler;
+
+			result = (handler == gloa_handler::eConstruct || handler == gloa_handler::eComponent
+				|| handler == gloa_handler::eInsert || handler == gloa_handler::eBinary
+				|| handler == gloa_handler::eUnary || handler == gloa_handler::eIntrinsic);
+
+			for (const gir_tree &c : gt.children())
+				result &= is_uniform(c);
+		}
+
+		uniform.emplace(gt.index, result);
+		return result;
+	}
+
+	void count(const gir_tree &gt, std::unordered_set <int> &visited) {
+		if (!visited.insert(gt.index).second)
+			return;
+
+		for (const gir_tree &c : gt.children()) {
+			uses[c.index]++;
+			count(c, visited);
+		}
+	}
+
+	// Products used only by another product of the same chain are absorbed
+	// into it, shared ones end chains of their own
+	bool absorbed(const gir_tree &gt) {
+		return chain_product(gt) && uses[gt.index] == 1;
+	}
+
+	void flatten(const gir_tree &gt, factor_list &factors) {
+		for (const gir_tree &c : gt.children()) {
+			if (absorbed(c))
+				flatten(c, factors);
+			else
+				factors.push_back(c.index);
+		}
+	}
+
+	void collect(const gir_tree &gt, bool inner, std::unordered_set <int> &visited) {
+		if (!visited.insert(gt.index).second)
+			return;
+
+		bool product = chain_product(gt);
+		if (product && !inner) {
+			factor_list factors(chains.get_allocator().resource());
+			flatten(gt, factors);
+			products.emplace(factors, gt.index);
+			chains.emplace(gt.index, std::move(factors));
+		}
+
+		for (const gir_tree &c : gt.children())
+			collect(c, product && absorbed(c), visited);
+	}
+
+	gir_tree rewrite(const gir_tree &gt) {
+		if (auto it = rewritten.find(gt.index); it != rewritten.end())
+			return it->second;
+
+		gir_tree result;
+		if (auto it = chains.find(gt.index); it != chains.end() && it->second.size() > 2) {
+			result = order(it->second);
+		} else {
+			bool changed = false;
+
+			gir_children children;
+			for (const gir_tree &c : gt.children()) {
+				children.push_back(rewrite(c));
+				changed |= (children.back().index != c.index);
+			}
+
+			result = changed ? gir_tree::from(gt.data(), gt.header(), gt.cexpr(), std::move(children)) : gt;
+		}
+
+		rewritten.emplace(gt.index, result);
+		return result;
+	}
+
+	// Cheapest evaluation order of a chain (classic matrix-chain dynamic
+	// programming), counting scalar multiplications
+	gir_tree order(const factor_list &factors) {
+		std::pmr::memory_resource *resource = chains.get_allocator().resource();
+
+		int n = factors.size();
+
+		// Factor i is a dims[i] x dims[i + 1] matrix; a trailing vector has
+		// a single column
+		gloa last = gir_tree { factors[n - 1] }.header().type;
+
+		std::pmr::vector <int> dims(n + 1, resource);
+		for (int i = 0; i < n; i++)
+			dims[i] = dimension(gir_tree { factors[i] }.header().type);
+		dims[n] = is_vector(last) ? 1 : dimension(last);
+
+		// Whether factors i..j are all uniform
+		std::pmr::vector <bool> uniform_interval(n * n, false, resource);
+		for (int i = 0; i < n && hoisting; i++) {
+			for (int j = i; j < n && is_uniform(gir_tree { factors[j] }); j++)
+				uniform_interval[i * n + j] = true;
+		}
+
+		// Existing product of factors i..j, if any
+		std::pmr::vector <int> existing(n * n, -1, resource);
+		for (int i = 0; i < n; i++) {
+			for (int j = i + 1; j < n; j++) {
+				if (i == 0 && j == n - 1)
+					continue;
+
+				factor_list key(factors.begin() + i, factors.begin() + j + 1, resource);
+				if (auto it = products.find(key); it != products.end())
+					existing[i * n + j] = it->second;
+			}
+		}
+
+		std::pmr::vector <int> cost(n * n, 0, resource);
+		std::pmr::vector <int> split(n * n, -1, resource);
+		for (int length = 2; length <= n; length++) {
+			for (int i = 0; i + length - 1 < n; i++) {
+				int j = i + length - 1;
+				if (existing[i * n + j] != -1)
+					continue;
+
+				// NOTE: later splits first, so that ties keep the
+				// recorded left to right order
+				int weight = uniform_interval[i * n + j] ? 1 : INVOCATION_WEIGHT;
+
+				cost[i * n + j] = INT_MAX;
+				for (int k = j - 1; k >= i; k--) {
+					int c = cost[i * n + k] + cost[(k + 1) * n + j] + weight * dims[i] * dims[k + 1] * dims[j + 1];
+					if (c < cost[i * n + j]) {
+						cost[i * n + j] = c;
+						split[i * n + j] = k;
+					}
+				}
+			}
+		}
+
+		return build(factors, existing, split, 0, n - 1);
+	}
+
+	gir_tree build(const factor_list &factors, const std::pmr::vector <int> &existing, const std::pmr::vector <int> &split, int i, int j) {
+		int n = factors.size();
+		if (i == j)
+			return rewrite(gir_tree { factors[i] });
+		if (existing[i * n + j] != -1)
+			return rewrite(gir_tree { existing[i * n + j] });
+
+		int k = split[i * n + j];
+		gir_tree A = build(factors, existing, split, i, k);
+		gir_tree B = build(factors, existing, split, k + 1, j);
+
+		// Factors are square, so the last one decides the result type
+		gloa rtype = gir_tree { factors[j] }.header().type;
+		return gir_tree::from(eMul, { rtype }, A.cexpr() & B.cexpr(), { A, B });
+	}
+};
+
+gir_tree reassociate(const gir_tree &gt, std::pmr::memory_resource *resource, bool hoisting)
+{
+	reassociation state(resource, hoisting);
+
+	std::unordered_set <int> visited;
+	state.count(gt, visited);
+
+	visited.clear();
+	state.collect(gt, false, visited);
+
+	return state.rewrite(gt);
+}
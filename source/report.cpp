@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <unordered_map>
+
+#include "passes.hpp"
+
+// Nodes of a tree, with shared subtrees counted at each use
+static size_t tree_size(const gir_tree &gt, std::unordered_map <int, size_t> &sizes)
+{
+	if (auto it = sizes.find(gt.index); it != sizes.end())
+		return it->second;
+
+	size_t size = 1;
+	for (const gir_tree &c : gt.children())
+		size += tree_size(c, sizes);
+
+	sizes.emplace(gt.index, size);
+	return size;
+}
+
+static uint32_t matrix_dimension(gloa type)
+{
+	switch (type) {
+	case eMat2: return 2;
+	case eMat3: return 3;
+	case eMat4: return 4;
+	default: return 1;
+	}
+}
+
+static bool is_vector(gloa type)
+{
+	return type == eVec2 || type == eVec3 || type == eVec4;
+}
+
+// Scalar operations performed by a node; one per component of the result,
+// and one per term of each component for linear algebra products, whose
+// inner dimension is that of the matrix operand (the left one for M * M)
+static uint32_t operation_width(const gcir_graph &graph, int T)
+{
+	uint32_t width = std::max(gloa_info_of(graph.headers[T].type).components, 1u);
+	if (!(graph.data[T] == eMul))
+		return width;
+
+	gloa A = graph.headers[graph.refs[T][0]].type;
+	gloa B = graph.headers[graph.refs[T][1]].type;
+
+	uint32_t nA = matrix_dimension(A);
+	uint32_t nB = matrix_dimension(B);
+
+	// Matrix products, and products of a matrix with a vector on either side;
+	// scaling by a scalar is componentwise
+	if (nA > 1 && (nB > 1 || is_vector(B)))
+		width *= nA;
+	else if (is_vector(A) && nB > 1)
+		width *= nB;
+
+	return width;
+}
+
+void report_recording(const gir_tree &recorded, const gcir_graph &graph, size_t folded, translation_report &report)
+{
+	std::unordered_map <int, size_t> sizes;
+	report.tree_nodes = tree_size(recorded, sizes);
+	report.graph_nodes = graph.data.size();
+	report.cse_hit_rate = 1.0 - double(report.graph_nodes)/double(report.tree_nodes);
+
+	// Folded as the operations were recorded, and later by the passes
+	report.folded_constants = folded;
+}
+
+void report_translation(const gcir_graph &graph, const std::vector <pass_stats> &stats, translation_report &report)
+{
+	for (const pass_stats &ps : stats)
+		report.folded_constants += ps.folded;
+
+	report.alu_cost = 0;
+	report.transcendental_cost = 0;
+
+	// Every node of the graph is evaluated once per invocation
+	for (size_t T = 0; T < graph.data.size(); T++) {
+		if (!graph.data[T].holds <gloa> ())
+			continue;
+
+		gloa x = graph.data[T].get <gloa> ();
+
+		uint32_t cost = gloa_info_of(x).cost * operation_width(graph, T);
+		if (gloa_transcendental(x))
+			report.transcendental_cost += cost;
+		else
+			report.alu_cost += cost;
+	}
+}
@@ -1,6 +1,10 @@
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <map>
+#include <memory_resource>
 #include <set>
+#include <unordered_map>
 #include <variant>
 
 #include <fmt/format.h>
@@ -9,25 +13,11 @@
 #include "gir.hpp"
 #include "translate.hpp"
 
-static const std::string LAYOUT_INPUT_PREFIX = "_lin";
-static const std::string LAYOUT_OUTPUT_PREFIX = "_lout";
-static const std::string PUSH_CONSTANTS_PREFIX = "_pc";
+static const std::string LAYOUT_INPUT_PREFIX = gloa_info_of(eLayoutInput).glsl;
+static const std::string LAYOUT_OUTPUT_PREFIX = gloa_info_of(eLayoutOutput).glsl;
+static const std::string PUSH_CONSTANTS_PREFIX = gloa_info_of(ePushConstants).glsl;
 static const std::string PUSH_CONSTANTS_MEMBER_PREFIX = "m";
 
-static constexpr gloa scalar_type(gloa vector_type)
-{
-	switch (vector_type) {
-	case eVec2:
-	case eVec3:
-	case eVec4:
-		return eFloat32;
-	default:
-		break;
-	}
-
-	return eNone;
-}
-
 std::string function_call(const std::string &ftn, const std::vector <std::string> &args)
 {
 	std::string out = ftn + "(";
@@ -40,265 +30,407 @@ std::string function_call(const std::string &ftn, const std::vector <std::string
 	return out + ")";
 }
 
-// TODO: inlining certain sources...
+// Float literals always carry a decimal point or exponent, so that they keep
+// their type when written directly into an expression; GLSL has no literal
+// for infinities and NaNs, so those are written by their bits
+std::string float_literal(float x)
+{
+	if (std::isnan(x))
+		return "uintBitsToFloat(0x7fc00000u)";
+	if (std::isinf(x))
+		return x > 0 ? "uintBitsToFloat(0x7f800000u)" : "uintBitsToFloat(0xff800000u)";
+
+	std::string out = fmt::format("{}", x);
+	if (out.find_first_of(".en") == std::string::npos)
+		out += ".0";
+
+	return out;
+}
+
 struct translator {
 	// Full graph
-	gcir_graph graph;
+	const gcir_graph &graph;
 
 	// State data
 	int generator;
 	int T;
 
-	// Cached translations
-	std::map <int, statement_list> cache;
+	// Emitted statements, in program order
+	statement_list statements;
 
-	// Construction from graph only
-	translator(const gcir_graph &gcir) : graph(gcir), generator(0), T(0), cache() {}
+	// Cached translations; location holding the value of each translated node
+	std::pmr::unordered_map <int, identifier> cache;
 
-	using refs = std::vector <int>;
-	using handler = std::function <statement_list (const refs &)>;
+	// Number of references to each node
+	std::pmr::vector <int> uses;
 
-	statement_list handle_none(const refs &R) {
-		statement_list statements;
-		for (int C : R) {
-			auto [sC, _] = cached_translation(C);
-			statements.insert(statements.end(), sC.begin(), sC.end());
-		}
+	// Registers (in components) needed to evaluate each node; -1 if not
+	// computed yet
+	std::pmr::vector <int> pressure;
+
+	// Whether cheap values are recomputed at each use
+	bool rematerialize;
 
-		return statements;
+	// Construction from graph only
+	translator(const gcir_graph &gcir, bool rematerialize = false)
+			: graph(gcir), generator(0), T(0),
+			statements(gcir.resource()), cache(gcir.resource()),
+			uses(gcir.data.size(), 0, gcir.resource()),
+			pressure(gcir.data.size(), -1, gcir.resource()),
+			rematerialize(rematerialize) {
+		std::pmr::vector <bool> visited(gcir.data.size(), false, gcir.resource());
+		count(0, visited);
 	}
 
-	statement_list handle_layout_input(const refs &R) {
-		gloa type = std::get <gloa> (graph.data[R[0]]);
-		int binding = std::get <int> (graph.data[R[1]]);
-		return { statement::from(type, fmt::format("{}{}", LAYOUT_INPUT_PREFIX, binding), generator) };
+	void count(int t, std::pmr::vector <bool> &visited) {
+		if (visited[t])
+			return;
+
+		visited[t] = true;
+		for (int C : graph.refs[t]) {
+			uses[C]++;
+			count(C, visited);
+		}
 	}
 
-	statement_list handle_push_constants(const refs &R) {
-		gloa type = std::get <gloa> (graph.data[R[0]]);
-		int member = std::get <int> (graph.data[R[1]]);
-		return { statement::from(type, fmt::format("{}.{}{}", PUSH_CONSTANTS_PREFIX, PUSH_CONSTANTS_MEMBER_PREFIX, member), generator) };
+	// Type of the value of a node; literals have no header
+	gloa value_type(int t) const {
+		const gir_t &data = graph.data[t];
+		if (data.holds <float> ())
+			return eFloat32;
+		if (data.holds <int> ())
+			return eInt32;
+
+		return graph.headers[t].type;
 	}
 
-	statement_list handle_layout_output(const refs &R) {
-		int binding = std::get <int> (graph.data[R[0]]);
-		auto [statements, last] = cached_translation(R[1]);
-		statement after = statement::builtin_from(fmt::format("{}{}", LAYOUT_OUTPUT_PREFIX, binding), last.full_loc());
-		statements.push_back(after);
-		return statements;
+	// Literals and reads of inputs, written out wherever they are used
+	bool name(int t) const {
+		const gir_t &data = graph.data[t];
+		return data.holds <float> () || data.holds <int> () || data == eLayoutInput || data == ePushConstants;
 	}
 
-	statement_list handle_gl_position(const refs &R) {
-		auto [statements, last] = cached_translation(R[0]);
-		statement after = statement::builtin_from("gl_Position", last.full_loc());
-		statements.push_back(after);
-		return statements;
+	// Swizzles and negations of names, and vectors of literals
+	bool cheap(int t) const {
+		const gir_t &data = graph.data[t];
+		if (!data.holds <gloa> () || graph.refs[t].empty())
+			return false;
+
+		gloa_handler handler = gloa_info_of(data.get <gloa> ()).handler;
+		if (handler == gloa_handler::eComponent || handler == gloa_handler::eUnary)
+			return name(graph.refs[t][0]);
+
+		if (handler != gloa_handler::eConstruct)
+			return false;
+
+		for (int C : graph.refs[t]) {
+			if (!graph.data[C].holds <float> ())
+				return false;
+		}
+
+		return true;
 	}
 
-	// TODO: conglomerate handler for all vector types, scalar types... etc
-	statement_list handle_construct_f32(const refs &R) {
-		auto [statements, last] = cached_translation(R[1]);
-		statement after = statement::from(eFloat32, last.full_loc(), generator);
-		statements.push_back(after);
-		return statements;
+	// Registers held by the value of a node once computed
+	int footprint(int t) const {
+		if (name(t))
+			return 0;
+
+		gloa type = value_type(t);
+		return type == eNone ? 0 : gloa_info_of(type).components;
 	}
 
-	statement_list handle_construct_vector(const refs &R) {
-		static const std::unordered_map <gloa, std::string> VECTOR_CONSTRUCTOR {
-			{ eVec3, "vec3" },
-			{ eVec4, "vec4" },
-			{ eMat3, "mat3" },
-		};
+	// Sethi-Ullman numbering, generalized to values of different sizes;
+	// operands are evaluated by decreasing difference between what they
+	// need while computed and what they hold afterwards, which minimizes
+	// the peak for trees (shared values are counted at each use)
+	std::pmr::vector <int> schedule(int t) {
+		std::pmr::vector <int> order(graph.refs[t].begin(), graph.refs[t].end(), graph.resource());
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+			return label(a) - footprint(a) > label(b) - footprint(b);
+		});
+
+		return order;
+	}
 
-		gloa type = std::get <gloa> (graph.data[R[0]]);
-		int count = std::get <int> (graph.data[R[1]]);
+	int label(int t) {
+		if (pressure[t] != -1)
+			return pressure[t];
 
-		statement_list statements;
-		std::vector <std::string> args;
-		for (int i = 0; i < count; i++) {
-			auto [vi, last] = cached_translation(R[i + 2]);
-			statements.insert(statements.end(), vi.begin(), vi.end());
-			args.push_back(last.full_loc());
+		int held = 0;
+		int peak = 0;
+		for (int C : schedule(t)) {
+			peak = std::max(peak, held + label(C));
+			held += footprint(C);
 		}
 
-		statement after = statement::from(type, function_call(VECTOR_CONSTRUCTOR.at(type), args), generator);
-		statements.push_back(after);
-		return statements;
+		pressure[t] = std::max(peak, footprint(t));
+		return pressure[t];
 	}
 
-	statement_list handle_construct(const refs &R) {
-		gloa type = std::get <gloa> (graph.data[R[0]]);
+	using refs = gcir_refs;
 
-		// TODO: switch?
-		if (type == eFloat32)
-			return handle_construct_f32(R);
-		if (type == eVec3 || type == eVec4 || type == eMat3)
-			return handle_construct_vector(R);
+	identifier emit(gloa type, const std::string &source) {
+		statements.push_back(statement::from(type, source, generator));
+		return statements.back().loc;
+	}
 
-		throw fmt::system_error(1, "(cppsl) unknown type {}", type);
+	identifier emit_builtin(const std::string &prefix, const std::string &source) {
+		statements.push_back(statement::builtin_from(prefix, source));
+		return statements.back().loc;
 	}
 
-	statement_list handle_component(const refs &R) {
-		static const std::string postfixes[] { ".x", ".y", ".z", ".w" };
-		int index = std::get <int> (graph.data[R[0]]);
+	// Handlers; one per gloa_handler, all with the same signature
+	identifier handle_list(gloa, const gir_header &, const refs &R) {
+		for (int C : R)
+			cached_translation(C);
 
-		auto [statements, last] = cached_translation(R[1]);
-		statement after = statement::from(scalar_type(last.loc.type), last.full_loc() + postfixes[index], generator);
-		statements.push_back(after);
-		return statements;
+		return identifier::builtin_from("");
 	}
 
-	statement_list handle_binary_operation(const refs &R, gloa op) {
-		static const std::unordered_map <gloa, std::string> OPERATION_MAP {
-			{ eAdd, "+" }, { eMul, "*" }
-		};
+	identifier handle_layout_input(gloa, const gir_header &H, const refs &) {
+		return emit(H.type, fmt::format("{}{}", LAYOUT_INPUT_PREFIX, H.index));
+	}
 
-		assert(R.size() == 3);
-		gloa rtype = std::get <gloa> (graph.data[R[0]]);
-		auto [s0, s0_last] = cached_translation(R[1]);
-		auto [s1, s1_last] = cached_translation(R[2]);
+	identifier handle_push_constants(gloa, const gir_header &H, const refs &) {
+		return emit(H.type, fmt::format("{}.{}{}", PUSH_CONSTANTS_PREFIX, PUSH_CONSTANTS_MEMBER_PREFIX, H.index));
+	}
 
-		statement after = statement::from(rtype, fmt::format("{} {} {}", s0_last.full_loc(), OPERATION_MAP.at(op), s1_last.full_loc()), generator);
+	identifier handle_layout_output(gloa, const gir_header &H, const refs &R) {
+		identifier last = cached_translation(R[0]);
+		return emit_builtin(fmt::format("{}{}", LAYOUT_OUTPUT_PREFIX, H.index), last.full_id());
+	}
 
-		std::vector <statement> statements;
-		statements.insert(statements.end(), s0.begin(), s0.end());
-		statements.insert(statements.end(), s1.begin(), s1.end());
-		statements.push_back(after);
-		return statements;
+	identifier handle_builtin_output(gloa x, const gir_header &, const refs &R) {
+		identifier last = cached_translation(R[0]);
+		return emit_builtin(gloa_info_of(x).glsl, last.full_id());
 	}
 
-	statement_list handle_function(const refs &R) {
-		gloa type = std::get <gloa> (graph.data[R[0]]);
-		std::string ftn = std::get <std::string> (graph.data[R[1]]);
+	identifier handle_construct(gloa, const gir_header &H, const refs &R) {
+		const gloa_info &info = gloa_info_of(H.type);
+		if (info.handler != gloa_handler::eType)
+			throw fmt::system_error(1, "(cppsl) unknown type {}", info.name);
 
-		statement_list statements;
+		// Scalars are their argument, converted if need be; still a statement
+		// of their own, which is inlined like any other, since the argument's
+		// statement is not this node's to inline
+		if (info.components == 1) {
+			identifier last = cached_translation(R[0]);
+			if (value_type(R[0]) == H.type)
+				return emit(H.type, last.operand());
 
-		std::vector <std::string> args;
-		for (int i = 2; i < R.size(); i++) {
-			auto [vi, last] = cached_translation(R[i]);
-			statements.insert(statements.end(), vi.begin(), vi.end());
-			args.push_back(last.full_loc());
+			return emit(H.type, function_call(info.glsl, { last.full_id() }));
 		}
 
-		statement after = statement::from(type, function_call(ftn, args), generator);
-		statements.push_back(after);
-		return statements;
-	}
-
-	statement_list operator()(gloa x) {
-		const refs &R = graph.refs[T];
-		switch (x) {
-		case eNone:
-			return handle_none(R);
-		case eGlPosition:
-			return handle_gl_position(R);
-		case eConstruct:
-			return handle_construct(R);
-		case eComponent:
-			return handle_component(R);
-		case eLayoutInput:
-			return handle_layout_input(R);
-		case eLayoutOutput:
-			return handle_layout_output(R);
-		case ePushConstants:
-			return handle_push_constants(R);
-		case eFunction:
-			return handle_function(R);
-		case eAdd:
-		case eMul:
-			return handle_binary_operation(R, x);
-		default:
-			break;
+		std::vector <std::string> args;
+		for (int C : R)
+			args.push_back(cached_translation(C).full_id());
+
+		return emit(H.type, function_call(info.glsl, args));
+	}
+
+	static std::string swizzle_postfix(int mask) {
+		std::string postfix = ".";
+		for (int i = 0; i < swizzle_size(mask); i++)
+			postfix += "xyzw"[swizzle_component(mask, i)];
+
+		return postfix;
+	}
+
+	identifier handle_component(gloa, const gir_header &H, const refs &R) {
+		identifier last = cached_translation(R[0]);
+
+		// Swizzles of inlined swizzles read the vector underneath directly
+		int mask = H.index;
+		if (last.type == eNone && graph.data[R[0]] == eComponent) {
+			int inner = graph.headers[R[0]].index;
+
+			int composed = (swizzle_size(mask) - 1) << 8;
+			for (int i = 0; i < swizzle_size(mask); i++)
+				composed |= swizzle_component(inner, swizzle_component(mask, i)) << (2 * i);
+
+			last = cached_translation(graph.refs[R[0]][0]);
+			mask = composed;
 		}
 
-		throw fmt::system_error(1, "(cppsl) unexpected gloa of {}", x);
+		return emit(H.type, last.operand() + swizzle_postfix(mask));
+	}
+
+	// Copy of the vector with the swizzled components overwritten
+	identifier handle_insert(gloa, const gir_header &H, const refs &R) {
+		identifier vector = cached_translation(R[0]);
+		identifier value = cached_translation(R[1]);
+
+		identifier loc = emit(H.type, vector.full_id());
+		emit_builtin(loc.full_id() + swizzle_postfix(H.index), value.full_id());
+		return loc;
+	}
+
+	identifier handle_binary(gloa x, const gir_header &H, const refs &R) {
+		assert(R.size() == 2);
+		identifier s0 = cached_translation(R[0]);
+		identifier s1 = cached_translation(R[1]);
+
+		return emit(H.type, fmt::format("{} {} {}", s0.operand(), gloa_info_of(x).glsl, s1.operand()));
 	}
 
-	statement_list operator()(int x) {
-		return { statement::from(eInt32, fmt::format("{}", x), generator) };
+	identifier handle_unary(gloa x, const gir_header &H, const refs &R) {
+		identifier s0 = cached_translation(R[0]);
+		return emit(H.type, fmt::format("{}{}", gloa_info_of(x).glsl, s0.operand()));
 	}
 
-	statement_list operator()(float x) {
-		return { statement::from(eFloat32, fmt::format("{}", x), generator) };
+	identifier handle_intrinsic(gloa x, const gir_header &H, const refs &R) {
+		std::vector <std::string> args;
+		for (int C : R)
+			args.push_back(cached_translation(C).full_id());
+
+		return emit(H.type, function_call(gloa_info_of(x).glsl, args));
 	}
 
-	statement_list operator()(const std::string &x) {
+	identifier handle_unsupported(gloa x, const gir_header &, const refs &) {
+		throw fmt::system_error(1, "(cppsl) unexpected gloa of {}", gloa_info_of(x).name);
+	}
+
+	using handler = identifier (translator::*)(gloa, const gir_header &, const refs &);
+
+	// Indexed by gloa_handler
+	static constexpr handler HANDLERS[] {
+		&translator::handle_unsupported,	// types are never nodes
+		&translator::handle_list,
+		&translator::handle_construct,
+		&translator::handle_component,
+		&translator::handle_insert,
+		&translator::handle_intrinsic,
+		&translator::handle_layout_input,
+		&translator::handle_layout_output,
+		&translator::handle_push_constants,
+		&translator::handle_binary,
+		&translator::handle_builtin_output,
+		&translator::handle_unary,
+		&translator::handle_unsupported,
+	};
+
+	static_assert(std::size(HANDLERS) == size_t(gloa_handler::eUnsupported) + 1);
+
+	identifier operator()(gloa x) {
+		handler h = HANDLERS[size_t(gloa_info_of(x).handler)];
+		return (this->*h)(x, graph.headers[T], graph.refs[T]);
+	}
+
+	identifier operator()(int x) {
+		return emit(eInt32, fmt::format("{}", x));
+	}
+
+	identifier operator()(float x) {
+		return emit(eFloat32, float_literal(x));
+	}
+
+	identifier operator()(const std::string &x) {
 		throw fmt::system_error(1, "(cppsl) unexpected string node {}", x);
 	}
 
-	statement_list translate(int t = 0) {
+	identifier translate(int t = 0) {
+		// Operands in register-saving order; the handler then finds
+		// them all translated
+		for (int C : schedule(t))
+			cached_translation(C);
+
 		T = t;
-		auto statements = std::visit(*this, graph.data[T]);
-		cache[t] = statements;
-		return statements;
+		identifier loc = inline_value(t, graph.data[T].visit(*this));
+		cache.emplace(t, loc);
+		return loc;
 	}
 
-	std::pair <statement_list, statement> cached_translation(int t) {
-		if (cache.count(t)) {
-			const auto &statements = cache[t];
-			return std::make_pair(statement_list {}, statements.back());
-		} else {
-			auto statements = translate(t);
-			return std::make_pair(statements, statements.back());
+	// Literals and reads of inputs are written directly wherever they are
+	// used, as are values with a single use; temporaries are only declared
+	// for values which are used more than once, unless cheap enough to be
+	// recomputed at each use instead
+	identifier inline_value(int t, const identifier &loc) {
+		if (loc.type == eNone || statements.empty() || statements.back().loc.full_id() != loc.full_id())
+			return loc;
+
+		const gir_t &data = graph.data[t];
+		if (!name(t) && uses[t] != 1 && !(rematerialize && cheap(t)))
+			return loc;
+
+		std::string source = statements.back().source;
+		statements.pop_back();
+		generator--;
+
+		// Operators (and negative literals) may bind looser than the
+		// operators consuming them
+		bool compound = source.starts_with('-');
+		if (data.holds <gloa> ()) {
+			gloa_handler handler = gloa_info_of(data.get <gloa> ()).handler;
+			compound |= (handler == gloa_handler::eBinary || handler == gloa_handler::eUnary);
 		}
+
+		return identifier::inline_from(source, compound);
+	}
+
+	identifier cached_translation(int t) {
+		if (auto it = cache.find(t); it != cache.end())
+			return it->second;
+
+		return translate(t);
 	}
 };
 
 // Gathering shader input/output usage
 struct shader_io {
-	std::set <std::pair <gloa, int>> layout_inputs;
-	std::set <int> layout_outputs;
-	std::map <int, std::pair <gloa, int>> push_constants;
+	std::pmr::set <std::pair <gloa, int>> layout_inputs;
+	std::pmr::set <std::pair <gloa, int>> layout_outputs;
+	std::pmr::map <int, std::pair <gloa, int>> push_constants;
+
+	shader_io(std::pmr::memory_resource *resource)
+			: layout_inputs(resource), layout_outputs(resource), push_constants(resource) {}
 };
 
-shader_io gather_shader_io(const gcir_graph &graph, int T = 0)
+void gather_shader_io(const gcir_graph &graph, int T, shader_io &io, std::pmr::vector <bool> &visited)
 {
+	if (visited[T])
+		return;
+
+	visited[T] = true;
+
 	const gir_t &data = graph.data[T];
+	const gir_header &H = graph.headers[T];
 	const auto &R = graph.refs[T];
 
-	shader_io combined;
-	if (std::holds_alternative <gloa> (data)) {
-		gloa x = std::get <gloa> (data);
+	if (data.holds <gloa> ()) {
+		gloa x = data.get <gloa> ();
 		if (x == eLayoutInput) {
-			gloa type = std::get <gloa> (graph.data[R[0]]);
-			int binding = std::get <int> (graph.data[R[1]]);
-			combined.layout_inputs = { std::make_pair(type, binding) };
+			io.layout_inputs.insert(std::make_pair(H.type, H.index));
 		} else if (x == eLayoutOutput) {
-			int binding = std::get <int> (graph.data[R[0]]);
-			combined.layout_outputs = { binding };
+			io.layout_outputs.insert(std::make_pair(H.type, H.index));
 		} else if (x == ePushConstants) {
-			gloa type = std::get <gloa> (graph.data[R[0]]);
-			int member = std::get <int> (graph.data[R[1]]);
-			int offset = std::get <int> (graph.data[R[2]]);
-			combined.push_constants = { std::make_pair(member, std::make_pair(type, offset)) };
+			// Check for no conflicting members
+			auto info = std::make_pair(H.type, H.offset);
+			auto [it, inserted] = io.push_constants.emplace(H.index, info);
+			assert(inserted || it->second == info);
 		}
 	}
 
-	for (int C : R) {
-		auto io = gather_shader_io(graph, C);
-		combined.layout_inputs.insert(io.layout_inputs.begin(), io.layout_inputs.end());
-		combined.layout_outputs.insert(io.layout_outputs.begin(), io.layout_outputs.end());
-
-		// Check for no conflicting members
-		for (const auto &[member, info] : io.push_constants) {
-			if (combined.push_constants.count(member))
-				assert(combined.push_constants[member] == info);
-			else
-				combined.push_constants[member] = info;
-		}
-	}
+	for (int C : R)
+		gather_shader_io(graph, C, io, visited);
+}
 
-	return combined;
+shader_io gather_shader_io(const gcir_graph &graph)
+{
+	shader_io io(graph.resource());
+	std::pmr::vector <bool> visited(graph.data.size(), false, graph.resource());
+	gather_shader_io(graph, 0, io, visited);
+	return io;
 }
 
 namespace detail {
 
-// TODO: separate optimization stage
-
 // TODO: pass the gcir instead; compress before translation...
-std::string translate(const gcir_graph &graph, const std::vector <unt_layout_output> &louts)
+std::string translate(const gcir_graph &graph, const shader_interface &interface,
+		const translation_options &options, translation_report *report)
 {
-	fmt::println("\ncompressed graph:\n{}", graph);
+	if (options.verbose)
+		fmt::println("\ncompressed graph:\n{}", graph);
 
 	// Grab information of all shader inputs and outputs
 	auto io = gather_shader_io(graph);
@@ -306,39 +438,39 @@ std::string translate(const gcir_graph &graph, const std::vector <unt_layout_out
 	// TODO: also all output bindings
 
 	// Fill in the rest of the program
-	std::string code = "#version 450\n";
+	std::pmr::string code("#version 450\n", graph.resource());
 
 	// Input layout bindings
 	for (auto [type, binding] : io.layout_inputs) {
-		code += fmt::format("layout (location = {}) in {} {}{};\n",
-			binding, gloa_type_string(type), LAYOUT_INPUT_PREFIX, binding);
+		code += fmt::format("layout (location = {}) {}in {} {}{};\n",
+			binding, interface.flat_inputs.contains(binding) ? "flat " : "",
+			gloa_info_of(type).glsl, LAYOUT_INPUT_PREFIX, binding);
 	}
 
 	// Output layout bindings
-	for (auto binding : io.layout_outputs) {
-		gloa type = louts[binding].type;
-		code += fmt::format("layout (location = {}) out {} {}{};\n",
-			binding, gloa_type_string(type), LAYOUT_OUTPUT_PREFIX, binding);
+	for (auto [type, binding] : io.layout_outputs) {
+		code += fmt::format("layout (location = {}) {}out {} {}{};\n",
+			binding, interface.flat_outputs.contains(binding) ? "flat " : "",
+			gloa_info_of(type).glsl, LAYOUT_OUTPUT_PREFIX, binding);
 	}
 
 	// Push constants
 	if (io.push_constants.size()) {
-		// fmt::println("pc_struct:");
-		// for (const auto &[member, info] : pc_struct)
-		// 	fmt::println("  {}: {:<5} +{}", member, gloa_type_string(info.first), info.second);
-
 		code += fmt::format("layout (push_constant) uniform PushConstants {{\n");
-		// TODO: track the size for necessary paddings
+
+		// Pad only where the std430 alignment of the member does not
+		// already place it at its offset (e.g. unused members)
 		int offed = 0;
 		for (const auto &[member, info] : io.push_constants) {
-			assert(offed <= info.second);
-			if (offed < info.second) {
+			int aligned = gloa_align(offed, info.first);
+			assert(aligned <= info.second);
+			if (aligned < info.second) {
 				int size = (info.second - offed)/sizeof(float);
 				code += fmt::format("  float _off{}[{}];\n", offed, size);
 			}
 
-			code += fmt::format("  {} {}{};\n", gloa_type_string(info.first), PUSH_CONSTANTS_MEMBER_PREFIX, member);
-			offed += gloa_type_offset(info.first);
+			code += fmt::format("  {} {}{};\n", gloa_info_of(info.first).glsl, PUSH_CONSTANTS_MEMBER_PREFIX, member);
+			offed = info.second + gloa_info_of(info.first).size;
 		}
 
 		code += fmt::format("}} {};\n", PUSH_CONSTANTS_PREFIX);
@@ -346,16 +478,300 @@ std::string translate(const gcir_graph &graph, const std::vector <unt_layout_out
 
 	code += "void main() {\n";
 
-	auto tr = translator(graph);
-	auto statements = tr.translate();
-	for (const statement &s : statements)
+	auto tr = translator(graph, options.rematerialize);
+	tr.translate();
+	for (const statement &s : tr.statements)
 		code += fmt::format("  {}\n", s);
 
 	code += "}\n";
 
-	fmt::println("final source:\n{}", code);
+	std::string source(code);
+	if (options.verbose)
+		fmt::println("final source:\n{}", source);
+
+	if (report) {
+		report->statements = tr.statements.size();
+		report->temporaries = std::ranges::count_if(tr.statements,
+			[](const statement &s) { return s.loc.type != eNone; });
+	}
+
+	return source;
+}
+
+void check_push_constants(const gcir_graph &vertex, const gcir_graph &fragment)
+{
+	auto vio = gather_shader_io(vertex);
+	auto fio = gather_shader_io(fragment);
+
+	// Every member either stage reads, with the same type and offset in both
+	std::pmr::map <int, std::pair <gloa, int>> members(vio.push_constants, vertex.resource());
+	for (const auto &[member, info] : fio.push_constants) {
+		auto [it, inserted] = members.emplace(member, info);
+		if (inserted || it->second == info)
+			continue;
+
+		throw fmt::system_error(1, "(cppsl) push constant member {} is a {} at offset {} in the vertex shader "
+			"but a {} at offset {} in the fragment shader", member,
+			gloa_info_of(it->second.first).name, it->second.second,
+			gloa_info_of(info.first).name, info.second);
+	}
+
+	// ...and no two of them sharing bytes
+	std::pmr::multimap <int, std::pair <gloa, int>> ranges(vertex.resource());
+	for (const auto &[member, info] : members)
+		ranges.emplace(info.second, std::make_pair(info.first, member));
+
+	int end = 0;
+	int previous = -1;
+	for (const auto &[offset, info] : ranges) {
+		if (offset < end) {
+			throw fmt::system_error(1, "(cppsl) push constant members {} and {} overlap at offset {}",
+				previous, info.second, offset);
+		}
+
+		end = offset + int(gloa_info_of(info.first).size);
+		previous = info.second;
+	}
+}
+
+gcir_graph link(const gcir_graph &vertex, const gcir_graph &fragment, shader_interface &vinterface, shader_interface &finterface)
+{
+	auto fio = gather_shader_io(fragment);
+
+	// Types of the varyings the fragment shader reads
+	std::pmr::map <int, gloa> read(vertex.resource());
+	for (auto [type, binding] : fio.layout_inputs)
+		read.emplace(binding, type);
+
+	gir_tree root = expand(vertex);
+
+	gir_children outputs;
+	for (const gir_tree &output : root.children()) {
+		const gir_header &H = output.header();
+		if (!(output.data() == eLayoutOutput)) {
+			outputs.push_back(output);
+			continue;
+		}
+
+		auto it = read.find(H.index);
+		if (it == read.end())
+			continue;
+
+		if (it->second != H.type) {
+			throw fmt::system_error(1, "(cppsl) vertex output {} is a {} but read as a {}",
+				H.index, gloa_info_of(H.type).name, gloa_info_of(it->second).name);
+		}
+
+		read.erase(it);
+		outputs.push_back(output);
+	}
 
-	return code;
+	if (!read.empty())
+		throw fmt::system_error(1, "(cppsl) fragment input {} is never written", read.begin()->first);
+
+	bool cexpr = true;
+	for (const gir_tree &gt : outputs)
+		cexpr &= gt.cexpr();
+
+	gcir_graph linked = compress(gir_tree::from(eNone, {}, cexpr, std::move(outputs)), vertex.resource());
+
+	// Varyings with the same value at every vertex
+	for (int T : linked.refs[0]) {
+		if (!(linked.data[T] == eLayoutOutput) || !uniform_node(linked, linked.refs[T][0]))
+			continue;
+
+		int binding = linked.headers[T].index;
+		vinterface.flat_outputs.insert(binding);
+		finterface.flat_inputs.insert(binding);
+	}
+
+	return linked;
+}
+
+// Locations taken by a varying of the given type
+static int location_count(gloa type)
+{
+	switch (type) {
+	case eMat3: return 3;
+	case eMat4: return 4;
+	default: return 1;
+	}
+}
+
+static gloa packed_type(int components)
+{
+	return components == 1 ? eFloat32 : gloa(eVec2 + (components - 2));
+}
+
+// Varyings sharing a single location
+struct varying_slot {
+	int location = -1;
+	bool flat = false;
+	int components = 0;
+
+	// Bindings of the members, in component order
+	std::vector <int> members;
+};
+
+// Fragment shader with its inputs replaced by reads of the packed locations
+static gir_tree unpack_inputs(const gir_tree &gt, const std::map <int, gir_tree> &unpacked,
+		std::unordered_map <int, gir_tree> &rewritten)
+{
+	if (auto it = rewritten.find(gt.index); it != rewritten.end())
+		return it->second;
+
+	gir_tree result = gt;
+	if (gt.data() == eLayoutInput) {
+		if (auto it = unpacked.find(gt.header().index); it != unpacked.end())
+			result = it->second;
+	} else {
+		bool changed = false;
+
+		gir_children children;
+		for (const gir_tree &c : gt.children()) {
+			children.push_back(unpack_inputs(c, unpacked, rewritten));
+			changed |= (children.back().index != c.index);
+		}
+
+		if (changed)
+			result = gir_tree::from(gt.data(), gt.header(), gt.cexpr(), std::move(children));
+	}
+
+	rewritten.emplace(gt.index, result);
+	return result;
+}
+
+void pack_varyings(gcir_graph &vertex, gcir_graph &fragment, shader_interface &vinterface, shader_interface &finterface)
+{
+	gir_tree vroot = expand(vertex);
+
+	// Varyings (all read, after linking) by binding; vec4s and matrices
+	// already fill their locations
+	std::map <int, gir_tree> written;
+	std::set <int> taken;
+	std::set <int> packable;
+	for (const gir_tree &output : vroot.children()) {
+		if (!(output.data() == eLayoutOutput))
+			continue;
+
+		const gir_header &H = output.header();
+		written.emplace(H.index, output);
+
+		if (H.type == eFloat32 || H.type == eVec2 || H.type == eVec3) {
+			packable.insert(H.index);
+		} else {
+			for (int i = 0; i < location_count(H.type); i++)
+				taken.insert(H.index + i);
+		}
+	}
+
+	auto components = [&](int binding) {
+		return int(gloa_info_of(written.at(binding).header().type).components);
+	};
+
+	// First fit, widest varyings first; interpolation is decided per
+	// location, so flat varyings are only packed with each other
+	std::vector <int> order(packable.begin(), packable.end());
+	std::stable_sort(order.begin(), order.end(),
+		[&](int a, int b) { return components(a) > components(b); });
+
+	std::vector <varying_slot> slots;
+	for (int binding : order) {
+		bool flat = vinterface.flat_outputs.contains(binding);
+		int n = components(binding);
+
+		auto it = std::find_if(slots.begin(), slots.end(),
+			[&](const varying_slot &slot) { return slot.flat == flat && slot.components + n <= 4; });
+
+		if (it == slots.end())
+			it = slots.insert(slots.end(), { .location = -1, .flat = flat, .components = 0, .members = {} });
+
+		it->components += n;
+		it->members.push_back(binding);
+	}
+
+	// Nothing shares a location
+	if (slots.size() == packable.size())
+		return;
+
+	// Lowest locations left free by the other varyings
+	int location = 0;
+	for (varying_slot &slot : slots) {
+		while (taken.contains(location))
+			location++;
+
+		slot.location = location++;
+	}
+
+	// Each location is written once, as a construction of its members, in
+	// place of its first member; each member is read back as a swizzle
+	std::map <int, gir_tree> packed;
+	std::map <int, gir_tree> unpacked;
+	for (const varying_slot &slot : slots) {
+		gloa type = packed_type(slot.components);
+		gir_tree input = gir_tree::vfrom(eLayoutInput, { type, slot.location });
+
+		bool cexpr = true;
+
+		gir_children values;
+		int offset = 0;
+		for (int binding : slot.members) {
+			const gir_tree &output = written.at(binding);
+			values.push_back(output.children()[0]);
+			cexpr &= output.cexpr();
+
+			int n = components(binding);
+			if (slot.members.size() == 1) {
+				unpacked.emplace(binding, input);
+			} else {
+				int mask = (n - 1) << 8;
+				for (int i = 0; i < n; i++)
+					mask |= (offset + i) << (2 * i);
+
+				unpacked.emplace(binding, gir_tree::from(eComponent, { output.header().type, mask }, false, { input }));
+			}
+
+			offset += n;
+		}
+
+		gir_tree value = values[0];
+		if (values.size() > 1)
+			value = gir_tree::from(eConstruct, { type }, cexpr, std::move(values));
+
+		packed.emplace(slot.members[0], gir_tree::from(eLayoutOutput, { type, slot.location }, cexpr, { value }));
+	}
+
+	gir_children outputs;
+	for (const gir_tree &output : vroot.children()) {
+		int binding = output.header().index;
+		if (!(output.data() == eLayoutOutput) || !packable.contains(binding))
+			outputs.push_back(output);
+		else if (auto it = packed.find(binding); it != packed.end())
+			outputs.push_back(it->second);
+	}
+
+	bool cexpr = true;
+	for (const gir_tree &gt : outputs)
+		cexpr &= gt.cexpr();
+
+	vertex = compress(gir_tree::from(eNone, {}, cexpr, std::move(outputs)), vertex.resource());
+
+	std::unordered_map <int, gir_tree> rewritten;
+	fragment = compress(unpack_inputs(expand(fragment), unpacked, rewritten), fragment.resource());
+
+	// Interpolation qualifiers move along with the varyings
+	for (int binding : packable) {
+		vinterface.flat_outputs.erase(binding);
+		finterface.flat_inputs.erase(binding);
+	}
+
+	for (const varying_slot &slot : slots) {
+		if (!slot.flat)
+			continue;
+
+		vinterface.flat_outputs.insert(slot.location);
+		finterface.flat_inputs.insert(slot.location);
+	}
 }
 
 }
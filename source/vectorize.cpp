@@ -0,0 +1,281 @@
+#include <map>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "gir.hpp"
+
+// Superword-level parallelism; vectors constructed from isomorphic scalar
+// operations, e.g. vec3(a.x * s, a.y * s, a.z * s), are rewritten as a
+// single vector operation on packed operands, here a.xyz * s
+using lane_list = std::vector <int>;
+
+// Operations which apply to each component of a vector independently
+static bool componentwise(gloa x)
+{
+	switch (x) {
+	case eAdd: case eSub: case eMul: case eDiv: case eNeg:
+	case eAbs: case eSign: case eFloor: case eCeil: case eFract:
+	case eSqrt: case eInverseSqrt: case eExp: case eExp2: case eLog: case eLog2:
+	case eSin: case eCos: case eTan:
+	case eMin: case eMax: case eClamp: case eMix: case eStep: case eSmoothstep:
+	case ePow: case eFma:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Operations which accept a scalar in place of any vector operand
+static bool broadcasts(gloa x)
+{
+	return x == eAdd || x == eSub || x == eMul || x == eDiv;
+}
+
+static gloa vector_type(int n)
+{
+	return gloa(eVec2 + (n - 2));
+}
+
+struct vectorizer {
+	// Number of references to each node
+	std::pmr::unordered_map <int, int> uses;
+
+	std::pmr::unordered_map <int, gir_tree> rewritten;
+
+	// Packed forms of lanes, or nothing if they cannot be packed
+	std::map <lane_list, std::optional <gir_tree>> packed;
+
+	explicit vectorizer(std::pmr::memory_resource *resource)
+			: uses(resource), rewritten(resource) {}
+
+	void count(const gir_tree &gt, std::unordered_set <int> &visited) {
+		if (!visited.insert(gt.index).second)
+			return;
+
+		for (const gir_tree &c : gt.children()) {
+			uses[c.index]++;
+			count(c, visited);
+		}
+	}
+
+	// Lanes all reading single components of the same vector, as a swizzle
+	std::optional <gir_tree> pack_components(const lane_list &lanes) {
+		int n = lanes.size();
+
+		gir_tree first { lanes[0] };
+		if (!(first.data() == eComponent))
+			return std::nullopt;
+
+		gir_tree source = first.children()[0];
+
+		int mask = (n - 1) << 8;
+		for (int i = 0; i < n; i++) {
+			gir_tree lane { lanes[i] };
+			if (!(lane.data() == eComponent) || lane.children()[0].index != source.index)
+				return std::nullopt;
+
+			int lmask = lane.header().index;
+			if (swizzle_size(lmask) != 1)
+				return std::nullopt;
+
+			mask |= swizzle_component(lmask, 0) << (2 * i);
+		}
+
+		source = rewrite(source);
+
+		// The swizzle may name the whole vector, in order
+		const gloa_info &info = gloa_info_of(source.header().type);
+		bool identity = (uint32_t(n) == info.components);
+		for (int i = 0; i < n && identity; i++)
+			identity = (swizzle_component(mask, i) == i);
+
+		if (identity)
+			return source;
+
+		return gir_tree::from(eComponent, { vector_type(n), mask }, source.cexpr(), { source });
+	}
+
+	// Lanes all applying the same componentwise operation to scalars
+	std::optional <gir_tree> pack_operations(const lane_list &lanes) {
+		int n = lanes.size();
+
+		gir_tree first { lanes[0] };
+		if (!first.data().holds <gloa> ())
+			return std::nullopt;
+
+		gloa x = first.data().get <gloa> ();
+		if (!componentwise(x))
+			return std::nullopt;
+
+		size_t arity = first.children().size();
+		for (int i = 0; i < n; i++) {
+			gir_tree lane { lanes[i] };
+			if (!(lane.data() == x) || lane.header().type != eFloat32 || lane.children().size() != arity)
+				return std::nullopt;
+
+			// Lanes needed elsewhere would be computed twice
+			if (uses[lane.index] > 1)
+				return std::nullopt;
+		}
+
+		bool cexpr = true;
+
+		gir_children operands;
+		for (size_t k = 0; k < arity; k++) {
+			lane_list operand;
+			for (int i = 0; i < n; i++)
+				operand.push_back(gir_tree { lanes[i] }.children()[k].index);
+
+			auto p = pack_operand(operand, broadcasts(x));
+			if (!p)
+				return std::nullopt;
+
+			operands.push_back(*p);
+			cexpr &= p->cexpr();
+		}
+
+		return gir_tree::from(x, { vector_type(n) }, cexpr, std::move(operands));
+	}
+
+	// Operands of a packed operation; the same scalar in every lane is kept
+	// as is when the operation broadcasts it, and splatted otherwise
+	std::optional <gir_tree> pack_operand(const lane_list &lanes, bool broadcast) {
+		bool uniform = true;
+		for (int lane : lanes)
+			uniform &= (lane == lanes[0]);
+
+		if (uniform) {
+			gir_tree scalar = rewrite(gir_tree { lanes[0] });
+			if (broadcast)
+				return scalar;
+
+			return gir_tree::from(eConstruct, { vector_type(lanes.size()) }, scalar.cexpr(), { scalar });
+		}
+
+		return pack(lanes);
+	}
+
+	// Literal lanes, as a constant vector
+	std::optional <gir_tree> pack_literals(const lane_list &lanes) {
+		gir_children components;
+		for (int lane : lanes) {
+			gir_tree literal { lane };
+			if (!literal.data().holds <float> ())
+				return std::nullopt;
+
+			components.push_back(literal);
+		}
+
+		return gir_tree::cfrom(eConstruct, { vector_type(lanes.size()) }, std::move(components));
+	}
+
+	std::optional <gir_tree> pack(const lane_list &lanes) {
+		if (auto it = packed.find(lanes); it != packed.end())
+			return it->second;
+
+		std::optional <gir_tree> result = pack_components(lanes);
+		if (!result)
+			result = pack_literals(lanes);
+		if (!result)
+			result = pack_operations(lanes);
+
+		packed.emplace(lanes, result);
+		return result;
+	}
+
+	// Scalar arguments of a vector construction, packed in runs of two or
+	// more lanes where possible
+	std::optional <gir_tree> vectorize_construct(const gir_tree &gt) {
+		gloa type = gt.header().type;
+		if (type != eVec2 && type != eVec3 && type != eVec4)
+			return std::nullopt;
+
+		const gir_children &args = gt.children();
+		if (args.size() != gloa_info_of(type).components)
+			return std::nullopt;
+
+		for (const gir_tree &arg : args) {
+			if (arg.header().type != eFloat32)
+				return std::nullopt;
+		}
+
+		int n = args.size();
+
+		bool changed = false;
+		bool cexpr = true;
+
+		gir_children packed_args;
+		for (int i = 0; i < n; ) {
+			// Longest run starting at this lane
+			std::optional <gir_tree> run;
+
+			int j = n;
+			for (; j >= i + 2; j--) {
+				lane_list lanes;
+				for (int k = i; k < j; k++)
+					lanes.push_back(args[k].index);
+
+				if ((run = pack(lanes)) && !run->cexpr())
+					break;
+
+				run.reset();
+			}
+
+			if (run) {
+				packed_args.push_back(*run);
+				changed = true;
+				i = j;
+			} else {
+				packed_args.push_back(rewrite(args[i]));
+				changed |= (packed_args.back().index != args[i].index);
+				i++;
+			}
+
+			cexpr &= packed_args.back().cexpr();
+		}
+
+		if (!changed)
+			return std::nullopt;
+
+		// A single run covering every lane is the vector itself
+		if (packed_args.size() == 1 && packed_args[0].header().type == type)
+			return packed_args[0];
+
+		return gir_tree::from(eConstruct, gt.header(), cexpr, std::move(packed_args));
+	}
+
+	gir_tree rewrite(const gir_tree &gt) {
+		if (auto it = rewritten.find(gt.index); it != rewritten.end())
+			return it->second;
+
+		std::optional <gir_tree> result;
+		if (gt.data() == eConstruct)
+			result = vectorize_construct(gt);
+
+		if (!result) {
+			bool changed = false;
+
+			gir_children children;
+			for (const gir_tree &c : gt.children()) {
+				children.push_back(rewrite(c));
+				changed |= (children.back().index != c.index);
+			}
+
+			result = changed ? gir_tree::from(gt.data(), gt.header(), gt.cexpr(), std::move(children)) : gt;
+		}
+
+		rewritten.emplace(gt.index, *result);
+		return *result;
+	}
+};
+
+gir_tree vectorize(const gir_tree &gt, std::pmr::memory_resource *resource)
+{
+	vectorizer state(resource);
+
+	std::unordered_set <int> visited;
+	state.count(gt, visited);
+
+	return state.rewrite(gt);
+}